@@ -22,6 +22,50 @@
 #include <vector>
 
 using namespace llvm;
+
+class ASTWriter;
+class SharedExprAST;
+
+/// SourceLocation - Line and column (both 1-based) of a token in the source.
+struct SourceLocation {
+  int Line = 0;
+  int Col = 0;
+};
+
+/// TypeKind - The value types of the language. Arithmetic on mixed scalar
+/// types promotes to the later kind in this list. Arrays are pointers into
+/// host memory and only appear as function arguments.
+enum TypeKind {
+  ty_bool,
+  ty_int64,
+  ty_float32,
+  ty_double,
+  ty_int64_array,
+  ty_float32_array,
+  ty_double_array
+};
+
+inline bool isArrayType(TypeKind Ty) { return Ty >= ty_int64_array; }
+
+/// getElementType - The scalar held by an array type.
+inline TypeKind getElementType(TypeKind Ty) {
+  switch (Ty) {
+  case ty_int64_array:
+    return ty_int64;
+  case ty_float32_array:
+    return ty_float32;
+  case ty_double_array:
+    return ty_double;
+  default:
+    return Ty;
+  }
+}
+
+/// getArrayType - The array type with elements of scalar kind \p Ty.
+inline TypeKind getArrayType(TypeKind Ty) {
+  return TypeKind(Ty - ty_int64 + ty_int64_array);
+}
+
 /// ExprAST - Base class for all expression nodes.
 class ExprAST {
   // public:
@@ -29,10 +73,21 @@ class ExprAST {
   //   IRBuilder<> Builder(TheContext);
   //   std::unique_ptr<Module> TheModule = std::make_unique<Module>("my cool
   //   jit", *TheContext);
+  SourceLocation Loc;
+
 public:
+  ExprAST(SourceLocation Loc = SourceLocation()) : Loc(Loc) {}
   virtual ~ExprAST(){};
+  int getLine() const { return Loc.Line; }
+  int getCol() const { return Loc.Col; }
+  /// getShared - This node as a reference to a hash-consed subexpression,
+  /// or null if it is an ordinary node.
+  virtual const SharedExprAST *getShared() const { return nullptr; }
   // Top level codegen virtual function.
   virtual llvm::Value *codegen() = 0;
+  /// serialize - Append this subtree to \p W, children first, and return the
+  /// index of its node record.
+  virtual uint32_t serialize(ASTWriter &W) const = 0;
   void initializeNodule() {}
 };
 
@@ -40,18 +95,59 @@ public:
 class NumberExprAST : public ExprAST {
   double Val;
   llvm::Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
 
 public:
-  NumberExprAST(double Val) : Val(Val) {}
+  NumberExprAST(SourceLocation Loc, double Val) : ExprAST(Loc), Val(Val) {}
+};
+
+/// IntegerExprAST - Expression class for integer literals like "1".
+class IntegerExprAST : public ExprAST {
+  int64_t Val;
+  llvm::Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
+
+public:
+  IntegerExprAST(SourceLocation Loc, int64_t Val) : ExprAST(Loc), Val(Val) {}
 };
 
 /// VariableExprAST - Expression class for referencing a variable, like "a".
 class VariableExprAST : public ExprAST {
   std::string Name;
   llvm::Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
+
+public:
+  VariableExprAST(SourceLocation Loc, const std::string &Name)
+      : ExprAST(Loc), Name(Name) {}
+};
+
+/// IndexExprAST - Expression class for reading an array element, like "a[i]".
+class IndexExprAST : public ExprAST {
+  std::string Name;
+  std::unique_ptr<ExprAST> Index;
+  llvm::Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
+
+public:
+  IndexExprAST(SourceLocation Loc, const std::string &Name,
+               std::unique_ptr<ExprAST> Index)
+      : ExprAST(Loc), Name(Name), Index(std::move(Index)) {}
+};
+
+/// StoreExprAST - Expression class for writing an array element, like
+/// "a[i] = v". Its value is the value stored.
+class StoreExprAST : public ExprAST {
+  std::string Name;
+  std::unique_ptr<ExprAST> Index, Val;
+  llvm::Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
 
 public:
-  VariableExprAST(const std::string &Name) : Name(Name) {}
+  StoreExprAST(SourceLocation Loc, const std::string &Name,
+               std::unique_ptr<ExprAST> Index, std::unique_ptr<ExprAST> Val)
+      : ExprAST(Loc), Name(Name), Index(std::move(Index)),
+        Val(std::move(Val)) {}
 };
 
 /// BinaryExprAST - Expression class for a binary operator.
@@ -59,11 +155,12 @@ class BinaryExprAST : public ExprAST {
   char Op;
   std::unique_ptr<ExprAST> LHS, RHS;
   llvm::Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
 
 public:
-  BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS,
+  BinaryExprAST(SourceLocation Loc, char op, std::unique_ptr<ExprAST> LHS,
                 std::unique_ptr<ExprAST> RHS)
-      : Op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+      : ExprAST(Loc), Op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
 };
 
 /// CallExprAST - Expression class for function calls.
@@ -71,11 +168,12 @@ class CallExprAST : public ExprAST {
   std::string Callee;
   std::vector<std::unique_ptr<ExprAST>> Args;
   llvm::Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
 
 public:
-  CallExprAST(const std::string &Callee,
+  CallExprAST(SourceLocation Loc, const std::string &Callee,
               std::vector<std::unique_ptr<ExprAST>> Args)
-      : Callee(Callee), Args(std::move(Args)) {}
+      : ExprAST(Loc), Callee(Callee), Args(std::move(Args)) {}
 };
 
 /// PrototypeAST - This class represents the "prototype" for a function,
@@ -84,13 +182,32 @@ public:
 class PrototypeAST {
   std::string Name;
   std::vector<std::string> Args;
+  std::vector<TypeKind> ArgTypes;
+  TypeKind RetType;
+  int Line;
+  bool FastMath;
 
 public:
-  PrototypeAST(const std::string &Name, std::vector<std::string> Args)
-      : Name(Name), Args(std::move(Args)) {}
+  /// Arguments without an entry in \p ArgTypes are doubles.
+  PrototypeAST(SourceLocation Loc, const std::string &Name,
+               std::vector<std::string> Args,
+               std::vector<TypeKind> ArgTypes = std::vector<TypeKind>(),
+               TypeKind RetType = ty_double, bool FastMath = false)
+      : Name(Name), Args(std::move(Args)), ArgTypes(std::move(ArgTypes)),
+        RetType(RetType), Line(Loc.Line), FastMath(FastMath) {
+    this->ArgTypes.resize(this->Args.size(), ty_double);
+  }
 
   const std::string &getName() const { return Name; }
+  TypeKind getArgType(unsigned i) const { return ArgTypes[i]; }
+  TypeKind getRetType() const { return RetType; }
+  int getLine() const { return Line; }
+  const std::vector<std::string> &getArgs() const { return Args; }
+  /// isFastMath - Whether the body may use relaxed FP semantics
+  /// (`def fastmath name(...)`).
+  bool isFastMath() const { return FastMath; }
   llvm::Function *codegen();
+  uint32_t serialize(ASTWriter &W) const;
 };
 
 /// FunctionAST - This class represents a function definition itself.
@@ -102,6 +219,8 @@ public:
   FunctionAST(std::unique_ptr<PrototypeAST> Proto,
               std::unique_ptr<ExprAST> Body)
       : Proto(std::move(Proto)), Body(std::move(Body)) {}
+  const PrototypeAST &getProto() const { return *Proto; }
+  const ExprAST &getBody() const { return *Body; }
   llvm::Function *codegen();
 };
 
@@ -109,10 +228,57 @@ class IfExprAST : public ExprAST {
   std::unique_ptr<ExprAST> Cond, Then,
       Else; // Build source AST tree for all these conditional statements
 public:
-  IfExprAST(std::unique_ptr<ExprAST> Cond, std::unique_ptr<ExprAST> Then,
-            std::unique_ptr<ExprAST> Else)
-      : Cond(std::move(Cond)), Then(std::move(Then)), Else(std::move(Else)) {}
+  IfExprAST(SourceLocation Loc, std::unique_ptr<ExprAST> Cond,
+            std::unique_ptr<ExprAST> Then, std::unique_ptr<ExprAST> Else)
+      : ExprAST(Loc), Cond(std::move(Cond)), Then(std::move(Then)),
+        Else(std::move(Else)) {}
+  Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
+};
+
+/// ForExprAST - Expression class for for/in. The int64 variable runs from
+/// Start up to, but not including, End; the loop's value is always 0.0.
+class ForExprAST : public ExprAST {
+  std::string VarName;
+  std::unique_ptr<ExprAST> Start, End, Step, Body;
+
+public:
+  ForExprAST(SourceLocation Loc, const std::string &VarName,
+             std::unique_ptr<ExprAST> Start, std::unique_ptr<ExprAST> End,
+             std::unique_ptr<ExprAST> Step, std::unique_ptr<ExprAST> Body)
+      : ExprAST(Loc), VarName(VarName), Start(std::move(Start)),
+        End(std::move(End)), Step(std::move(Step)), Body(std::move(Body)) {}
   Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
+};
+
+/// SharedExprAST - A reference to a hash-consed subexpression. When the
+/// parser shares structurally identical pure subexpressions, every
+/// occurrence becomes one of these pointing at a single canonical Node, and
+/// codegen emits that node once per function.
+class SharedExprAST : public ExprAST {
+  std::shared_ptr<ExprAST> Node;
+  unsigned ID;
+  llvm::Value *codegen() override;
+  uint32_t serialize(ASTWriter &W) const override;
+
+public:
+  SharedExprAST(SourceLocation Loc, std::shared_ptr<ExprAST> Node, unsigned ID)
+      : ExprAST(Loc), Node(std::move(Node)), ID(ID) {}
+  const SharedExprAST *getShared() const override { return this; }
+  const ExprAST &getNode() const { return *Node; }
+  /// getID - Identifies the canonical node among those of the same parse.
+  unsigned getID() const { return ID; }
+};
+
+/// TopLevelItem - One `def`, `extern` or top-level expression of a program,
+/// kept so a whole parsed program can be saved and replayed later.
+struct TopLevelItem {
+  enum ItemKind { Definition, Extern, Expression };
+
+  ItemKind Kind;
+  std::unique_ptr<FunctionAST> Fn;    // Definition and Expression
+  std::unique_ptr<PrototypeAST> Proto; // Extern
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,550 @@
+#include "ASTSerializer.h"
+#include "llvm/Support/FileSystem.h"
+#include <cstring>
+extern std::unique_ptr<ExprAST> LogError(const char *Str);
+
+using namespace kast;
+
+//===----------------------------------------------------------------------===//
+// Writing
+//===----------------------------------------------------------------------===//
+
+uint32_t ASTWriter::addString(StringRef Str) {
+  auto Result = StringIndex.insert(std::make_pair(Str, Strings.size()));
+  if (Result.second) {
+    StringEntry E;
+    E.Offset = StringData.size();
+    E.Size = Str.size();
+    Strings.push_back(E);
+    StringData += Str;
+  }
+  return Result.first->second;
+}
+
+uint32_t ASTWriter::addNode(const ExprAST &AST, NodeKind Kind, uint8_t Op,
+                            uint32_t Op0, uint32_t Op1, uint32_t Op2,
+                            uint64_t Value) {
+  NodeRecord N;
+  memset(&N, 0, sizeof(N));
+  N.Kind = Kind;
+  N.Op = Op;
+  N.Line = AST.getLine();
+  N.Col = AST.getCol();
+  N.Ops[0] = Op0;
+  N.Ops[1] = Op1;
+  N.Ops[2] = Op2;
+  N.Value = Value;
+  Nodes.push_back(N);
+  return Nodes.size() - 1;
+}
+
+uint32_t ASTWriter::addSharedRef(const SharedExprAST &Ref,
+                                 const ExprAST &Node) {
+  uint32_t Idx;
+  auto It = SharedIndex.find(&Node);
+  if (It != SharedIndex.end()) {
+    Idx = It->second;
+  } else {
+    bool Outer = InSharedNode;
+    InSharedNode = true;
+    Idx = Node.serialize(*this);
+    InSharedNode = Outer;
+    SharedIndex[&Node] = Idx;
+  }
+
+  // A nested occurrence at the node's own location is its first one, which
+  // needs no location of its own; see SharedExprAST::codegen.
+  if (InSharedNode && Ref.getLine() == Node.getLine() &&
+      Ref.getCol() == Node.getCol())
+    return Idx;
+  return addNode(Ref, NK_Shared, 0, Idx);
+}
+
+uint32_t ASTWriter::addOperands(ArrayRef<uint32_t> Ops) {
+  uint32_t First = Operands.size();
+  Operands.insert(Operands.end(), Ops.begin(), Ops.end());
+  return First;
+}
+
+uint32_t ASTWriter::addPrototype(const PrototypeAST &Proto) {
+  ProtoRecord P;
+  P.Name = addString(Proto.getName());
+  P.Line = Proto.getLine();
+  P.RetType = Proto.getRetType();
+  P.FastMath = Proto.isFastMath();
+  P.FirstArg = Args.size();
+  P.NumArgs = Proto.getArgs().size();
+  for (unsigned i = 0, e = Proto.getArgs().size(); i != e; ++i) {
+    ArgRecord A;
+    A.Name = addString(Proto.getArgs()[i]);
+    A.Type = Proto.getArgType(i);
+    Args.push_back(A);
+  }
+  Protos.push_back(P);
+  return Protos.size() - 1;
+}
+
+void ASTWriter::addItem(const TopLevelItem &Item) {
+  ItemRecord I;
+  I.Kind = Item.Kind;
+  I.Body = 0;
+  if (Item.Kind == TopLevelItem::Extern) {
+    I.Proto = addPrototype(*Item.Proto);
+  } else {
+    I.Proto = addPrototype(Item.Fn->getProto());
+    I.Body = Item.Fn->getBody().serialize(*this);
+  }
+  Items.push_back(I);
+}
+
+template <typename T> static void writeArray(raw_ostream &OS, ArrayRef<T> A) {
+  OS.write(reinterpret_cast<const char *>(A.data()), A.size() * sizeof(T));
+}
+
+void ASTWriter::write(raw_ostream &OS, StringRef SourceName) {
+  FileHeader H;
+  memcpy(H.Magic, kast::Magic, sizeof(H.Magic));
+  H.Version = kast::Version;
+  H.SourceName = addString(SourceName);
+  H.NumStrings = Strings.size();
+  H.StringDataSize = StringData.size();
+  H.NumNodes = Nodes.size();
+  H.NumOperands = Operands.size();
+  H.NumArgs = Args.size();
+  H.NumProtos = Protos.size();
+  H.NumItems = Items.size();
+
+  OS.write(reinterpret_cast<const char *>(&H), sizeof(H));
+  writeArray<StringEntry>(OS, Strings);
+  OS << StringData;
+  writeArray<NodeRecord>(OS, Nodes);
+  writeArray<ulittle32_t>(OS, Operands);
+  writeArray<ArgRecord>(OS, Args);
+  writeArray<ProtoRecord>(OS, Protos);
+  writeArray<ItemRecord>(OS, Items);
+}
+
+bool writeProgram(const std::vector<TopLevelItem> &Items, StringRef Path,
+                  StringRef SourceName) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LogError(("cannot open " + Path + ": " + EC.message()).str().c_str());
+    return false;
+  }
+
+  ASTWriter W;
+  for (const TopLevelItem &Item : Items)
+    W.addItem(Item);
+  W.write(OS, SourceName);
+  return true;
+}
+
+uint32_t NumberExprAST::serialize(ASTWriter &W) const {
+  uint64_t Bits;
+  memcpy(&Bits, &Val, sizeof(Bits));
+  return W.addNode(*this, NK_Number, 0, 0, 0, 0, Bits);
+}
+
+uint32_t IntegerExprAST::serialize(ASTWriter &W) const {
+  return W.addNode(*this, NK_Integer, 0, 0, 0, 0, Val);
+}
+
+uint32_t VariableExprAST::serialize(ASTWriter &W) const {
+  return W.addNode(*this, NK_Variable, 0, W.addString(Name));
+}
+
+uint32_t BinaryExprAST::serialize(ASTWriter &W) const {
+  uint32_t L = LHS->serialize(W);
+  uint32_t R = RHS->serialize(W);
+  return W.addNode(*this, NK_Binary, Op, L, R);
+}
+
+uint32_t CallExprAST::serialize(ASTWriter &W) const {
+  std::vector<uint32_t> ArgNodes;
+  for (auto &Arg : Args)
+    ArgNodes.push_back(Arg->serialize(W));
+  return W.addNode(*this, NK_Call, 0, W.addString(Callee),
+                   W.addOperands(ArgNodes), ArgNodes.size());
+}
+
+uint32_t IfExprAST::serialize(ASTWriter &W) const {
+  uint32_t C = Cond->serialize(W);
+  uint32_t T = Then->serialize(W);
+  uint32_t E = Else->serialize(W);
+  return W.addNode(*this, NK_If, 0, C, T, E);
+}
+
+uint32_t IndexExprAST::serialize(ASTWriter &W) const {
+  uint32_t I = Index->serialize(W);
+  return W.addNode(*this, NK_Index, 0, W.addString(Name), I);
+}
+
+uint32_t StoreExprAST::serialize(ASTWriter &W) const {
+  uint32_t I = Index->serialize(W);
+  uint32_t V = Val->serialize(W);
+  return W.addNode(*this, NK_Store, 0, W.addString(Name), I, V);
+}
+
+uint32_t ForExprAST::serialize(ASTWriter &W) const {
+  std::vector<uint32_t> Parts;
+  Parts.push_back(Start->serialize(W));
+  Parts.push_back(End->serialize(W));
+  if (Step)
+    Parts.push_back(Step->serialize(W));
+  Parts.push_back(Body->serialize(W));
+  return W.addNode(*this, NK_For, 0, W.addString(VarName),
+                   W.addOperands(Parts), Parts.size());
+}
+
+uint32_t SharedExprAST::serialize(ASTWriter &W) const {
+  return W.addSharedRef(*this, *Node);
+}
+
+//===----------------------------------------------------------------------===//
+// Reading
+//===----------------------------------------------------------------------===//
+
+bool isSerializedAST(StringRef Data) {
+  return Data.startswith(StringRef(kast::Magic, sizeof(kast::Magic)));
+}
+
+namespace {
+/// ASTReader - Rebuilds AST objects straight from the records of a mapped
+/// KAST image. Every index read from the file is range checked.
+class ASTReader {
+  StringRef Data;
+  const FileHeader *Header = nullptr;
+  const StringEntry *Strings = nullptr;
+  const char *StringData = nullptr;
+  const NodeRecord *Nodes = nullptr;
+  const ulittle32_t *Operands = nullptr;
+  const ArgRecord *Args = nullptr;
+  const ProtoRecord *Protos = nullptr;
+  const ItemRecord *Items = nullptr;
+
+  /// Built expressions, indexed like the node records. A node with a single
+  /// parent is taken out of this table by it; one with several, or one a
+  /// Shared record refers to, moves to SharedExprs and each parent gets a
+  /// SharedExprAST referring to it.
+  std::vector<std::unique_ptr<ExprAST>> Exprs;
+  std::vector<std::shared_ptr<ExprAST>> SharedExprs;
+  std::vector<uint32_t> RefCounts;
+
+  /// carve - Take the next \p Count records of type T from the image.
+  template <typename T>
+  bool carve(size_t &Offset, uint32_t Count, const T *&Array) {
+    uint64_t Size = uint64_t(Count) * sizeof(T);
+    if (Offset + Size > Data.size())
+      return false;
+    Array = reinterpret_cast<const T *>(Data.data() + Offset);
+    Offset += Size;
+    return true;
+  }
+
+  bool getString(uint32_t Idx, std::string &Str);
+  bool countRefs();
+  std::unique_ptr<ExprAST> takeExpr(uint32_t Idx);
+  std::shared_ptr<ExprAST> getShared(uint32_t Idx);
+  bool readNode(uint32_t Idx);
+  std::unique_ptr<PrototypeAST> readPrototype(uint32_t Idx);
+
+public:
+  ASTReader(StringRef Data) : Data(Data) {}
+  bool read(std::vector<TopLevelItem> &Result, std::string &SourceName);
+};
+} // namespace
+
+bool ASTReader::getString(uint32_t Idx, std::string &Str) {
+  if (Idx >= Header->NumStrings)
+    return false;
+  const StringEntry &E = Strings[Idx];
+  if (uint64_t(E.Offset) + E.Size > Header->StringDataSize)
+    return false;
+  Str.assign(StringData + E.Offset, E.Size);
+  return true;
+}
+
+/// countRefs - Count the parents of every node, to find the shared ones.
+bool ASTReader::countRefs() {
+  RefCounts.assign(Header->NumNodes, 0);
+  auto Ref = [&](uint32_t C) {
+    if (C < RefCounts.size())
+      ++RefCounts[C];
+  };
+  for (uint32_t i = 0; i != Header->NumNodes; ++i) {
+    const NodeRecord &N = Nodes[i];
+    switch (N.Kind) {
+    case NK_Binary:
+      Ref(N.Ops[0]);
+      Ref(N.Ops[1]);
+      break;
+    case NK_If:
+      Ref(N.Ops[0]);
+      Ref(N.Ops[1]);
+      Ref(N.Ops[2]);
+      break;
+    case NK_Index:
+      Ref(N.Ops[1]);
+      break;
+    case NK_Shared:
+      Ref(N.Ops[0]);
+      break;
+    case NK_Store:
+      Ref(N.Ops[1]);
+      Ref(N.Ops[2]);
+      break;
+    case NK_Call:
+    case NK_For: {
+      uint64_t First = N.Ops[1], Count = N.Ops[2];
+      if (First + Count > Header->NumOperands)
+        return false;
+      for (uint64_t j = First; j != First + Count; ++j)
+        Ref(Operands[j]);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+  for (uint32_t i = 0; i != Header->NumItems; ++i)
+    if (Items[i].Kind != TopLevelItem::Extern)
+      Ref(Items[i].Body);
+  return true;
+}
+
+std::unique_ptr<ExprAST> ASTReader::takeExpr(uint32_t Idx) {
+  if (Idx >= Exprs.size())
+    return nullptr;
+  if (RefCounts[Idx] < 2 && !SharedExprs[Idx])
+    return std::move(Exprs[Idx]);
+
+  auto Node = getShared(Idx);
+  if (!Node)
+    return nullptr;
+  SourceLocation Loc;
+  Loc.Line = Node->getLine();
+  Loc.Col = Node->getCol();
+  return std::make_unique<SharedExprAST>(Loc, std::move(Node), Idx);
+}
+
+/// getShared - The node \p Idx, moved to SharedExprs to be shared.
+std::shared_ptr<ExprAST> ASTReader::getShared(uint32_t Idx) {
+  if (!SharedExprs[Idx])
+    SharedExprs[Idx] = std::move(Exprs[Idx]);
+  return SharedExprs[Idx];
+}
+
+bool ASTReader::readNode(uint32_t Idx) {
+  const NodeRecord &N = Nodes[Idx];
+  SourceLocation Loc;
+  Loc.Line = N.Line;
+  Loc.Col = N.Col;
+
+  // Children were written first, so only indices below Idx are valid.
+  auto Child = [&](uint32_t C) -> std::unique_ptr<ExprAST> {
+    return C < Idx ? takeExpr(C) : nullptr;
+  };
+
+  std::unique_ptr<ExprAST> E;
+  switch (N.Kind) {
+  case NK_Number: {
+    uint64_t Bits = N.Value;
+    double Val;
+    memcpy(&Val, &Bits, sizeof(Val));
+    E = std::make_unique<NumberExprAST>(Loc, Val);
+    break;
+  }
+  case NK_Integer:
+    E = std::make_unique<IntegerExprAST>(Loc, int64_t(uint64_t(N.Value)));
+    break;
+  case NK_Variable: {
+    std::string Name;
+    if (!getString(N.Ops[0], Name))
+      return false;
+    E = std::make_unique<VariableExprAST>(Loc, Name);
+    break;
+  }
+  case NK_Binary: {
+    auto L = Child(N.Ops[0]);
+    auto R = Child(N.Ops[1]);
+    if (!L || !R)
+      return false;
+    E = std::make_unique<BinaryExprAST>(Loc, N.Op, std::move(L), std::move(R));
+    break;
+  }
+  case NK_Call: {
+    std::string Callee;
+    if (!getString(N.Ops[0], Callee))
+      return false;
+    uint64_t First = N.Ops[1], Count = N.Ops[2];
+    if (First + Count > Header->NumOperands)
+      return false;
+    std::vector<std::unique_ptr<ExprAST>> CallArgs;
+    for (uint64_t i = First; i != First + Count; ++i) {
+      CallArgs.push_back(Child(Operands[i]));
+      if (!CallArgs.back())
+        return false;
+    }
+    E = std::make_unique<CallExprAST>(Loc, Callee, std::move(CallArgs));
+    break;
+  }
+  case NK_If: {
+    auto C = Child(N.Ops[0]);
+    auto T = Child(N.Ops[1]);
+    auto F = Child(N.Ops[2]);
+    if (!C || !T || !F)
+      return false;
+    E = std::make_unique<IfExprAST>(Loc, std::move(C), std::move(T),
+                                    std::move(F));
+    break;
+  }
+  case NK_Index: {
+    std::string Name;
+    auto I = Child(N.Ops[1]);
+    if (!getString(N.Ops[0], Name) || !I)
+      return false;
+    E = std::make_unique<IndexExprAST>(Loc, Name, std::move(I));
+    break;
+  }
+  case NK_Store: {
+    std::string Name;
+    auto I = Child(N.Ops[1]);
+    auto V = Child(N.Ops[2]);
+    if (!getString(N.Ops[0], Name) || !I || !V)
+      return false;
+    E = std::make_unique<StoreExprAST>(Loc, Name, std::move(I), std::move(V));
+    break;
+  }
+  case NK_For: {
+    std::string VarName;
+    uint64_t First = N.Ops[1], Count = N.Ops[2];
+    if (!getString(N.Ops[0], VarName) || (Count != 3 && Count != 4) ||
+        First + Count > Header->NumOperands)
+      return false;
+    std::unique_ptr<ExprAST> Parts[4];
+    for (uint64_t i = 0; i != Count; ++i) {
+      Parts[i] = Child(Operands[First + i]);
+      if (!Parts[i])
+        return false;
+    }
+    // Without a step the body is the third operand.
+    if (Count == 3)
+      std::swap(Parts[2], Parts[3]);
+    E = std::make_unique<ForExprAST>(Loc, VarName, std::move(Parts[0]),
+                                     std::move(Parts[1]), std::move(Parts[2]),
+                                     std::move(Parts[3]));
+    break;
+  }
+  case NK_Shared: {
+    uint32_t Target = N.Ops[0];
+    if (Target >= Idx)
+      return false;
+    auto Node = getShared(Target);
+    if (!Node)
+      return false;
+    E = std::make_unique<SharedExprAST>(Loc, std::move(Node), Target);
+    break;
+  }
+  default:
+    return false;
+  }
+  Exprs[Idx] = std::move(E);
+  return true;
+}
+
+std::unique_ptr<PrototypeAST> ASTReader::readPrototype(uint32_t Idx) {
+  if (Idx >= Header->NumProtos)
+    return nullptr;
+  const ProtoRecord &P = Protos[Idx];
+  if (uint64_t(P.FirstArg) + P.NumArgs > Header->NumArgs ||
+      P.RetType > ty_double)
+    return nullptr;
+
+  std::string Name;
+  if (!getString(P.Name, Name))
+    return nullptr;
+
+  std::vector<std::string> ArgNames(P.NumArgs);
+  std::vector<TypeKind> ArgTypes;
+  for (uint32_t i = 0; i != P.NumArgs; ++i) {
+    const ArgRecord &A = Args[P.FirstArg + i];
+    if (!getString(A.Name, ArgNames[i]) || A.Type > ty_double_array)
+      return nullptr;
+    ArgTypes.push_back(TypeKind(uint32_t(A.Type)));
+  }
+
+  SourceLocation Loc;
+  Loc.Line = P.Line;
+  return std::make_unique<PrototypeAST>(Loc, Name, std::move(ArgNames),
+                                        std::move(ArgTypes),
+                                        TypeKind(uint32_t(P.RetType)),
+                                        P.FastMath != 0);
+}
+
+bool ASTReader::read(std::vector<TopLevelItem> &Result,
+                     std::string &SourceName) {
+  size_t Offset = 0;
+  if (!carve(Offset, 1, Header) || !isSerializedAST(Data)) {
+    LogError("not a serialized AST file");
+    return false;
+  }
+  if (Header->Version != kast::Version) {
+    LogError("unsupported serialized AST version");
+    return false;
+  }
+
+  if (!carve(Offset, Header->NumStrings, Strings) ||
+      !carve(Offset, Header->StringDataSize, StringData) ||
+      !carve(Offset, Header->NumNodes, Nodes) ||
+      !carve(Offset, Header->NumOperands, Operands) ||
+      !carve(Offset, Header->NumArgs, Args) ||
+      !carve(Offset, Header->NumProtos, Protos) ||
+      !carve(Offset, Header->NumItems, Items) ||
+      !getString(Header->SourceName, SourceName)) {
+    LogError("truncated serialized AST file");
+    return false;
+  }
+
+  if (!countRefs()) {
+    LogError("malformed expression in serialized AST file");
+    return false;
+  }
+  Exprs.resize(Header->NumNodes);
+  SharedExprs.resize(Header->NumNodes);
+  for (uint32_t i = 0; i != Header->NumNodes; ++i) {
+    if (!readNode(i)) {
+      LogError("malformed expression in serialized AST file");
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i != Header->NumItems; ++i) {
+    const ItemRecord &I = Items[i];
+    TopLevelItem Item;
+    Item.Kind = TopLevelItem::ItemKind(uint32_t(I.Kind));
+    auto Proto = readPrototype(I.Proto);
+    if (!Proto || I.Kind > TopLevelItem::Expression) {
+      LogError("malformed item in serialized AST file");
+      return false;
+    }
+
+    if (Item.Kind == TopLevelItem::Extern) {
+      Item.Proto = std::move(Proto);
+    } else {
+      auto Body = takeExpr(I.Body);
+      if (!Body) {
+        LogError("malformed item in serialized AST file");
+        return false;
+      }
+      Item.Fn = std::make_unique<FunctionAST>(std::move(Proto), std::move(Body));
+    }
+    Result.push_back(std::move(Item));
+  }
+  return true;
+}
+
+bool readProgram(StringRef Data, std::vector<TopLevelItem> &Items,
+                 std::string &SourceName) {
+  return ASTReader(Data).read(Items, SourceName);
+}
@@ -0,0 +1,148 @@
+#ifndef AST_SERIALIZER_H
+#define AST_SERIALIZER_H
+
+#include "AST.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Binary AST file ("KAST") layout. Every field is a little-endian integer
+// with alignment 1, so a mapped file is read in place on any host:
+//
+//   FileHeader
+//   StringEntry  [NumStrings]     offsets into the string data
+//   char         [StringDataSize] interned identifiers, not NUL terminated
+//   NodeRecord   [NumNodes]       expressions, children before parents; a
+//                                 hash-consed (shared) subexpression is
+//                                 written once and referred to by a Shared
+//                                 record at each occurrence
+//   ulittle32_t  [NumOperands]    call argument lists (node indices)
+//   ArgRecord    [NumArgs]        prototype arguments
+//   ProtoRecord  [NumProtos]
+//   ItemRecord   [NumItems]       top-level items in source order
+namespace kast {
+using support::ulittle32_t;
+using support::ulittle64_t;
+
+const char Magic[4] = {'K', 'A', 'S', 'T'};
+/// Bump whenever the layout or the meaning of a field changes.
+/// 2: array argument types and the Index, Store and For nodes.
+/// 3: nodes may be referred to by more than one parent.
+/// 4: Shared records give each occurrence of a shared node its location.
+const uint32_t Version = 4;
+
+enum NodeKind : uint8_t {
+  NK_Number,   // Value = bits of the double
+  NK_Integer,  // Value = the int64
+  NK_Variable, // Ops[0] = name
+  NK_Binary,   // Op, Ops[0] = LHS, Ops[1] = RHS
+  NK_Call,     // Ops[0] = callee, Ops[1] = first operand, Ops[2] = count
+  NK_If,       // Ops[0] = cond, Ops[1] = then, Ops[2] = else
+  NK_Index,    // Ops[0] = array name, Ops[1] = index
+  NK_Store,    // Ops[0] = array name, Ops[1] = index, Ops[2] = value
+  NK_For,      // Ops[0] = variable, Ops[1] = first operand, Ops[2] = count;
+               // operands are start, end, [step,] body
+  NK_Shared,   // Ops[0] = the shared node; the record's location is that of
+               // the occurrence. Within a shared node, references to other
+               // shared nodes point at them directly.
+};
+
+struct FileHeader {
+  char Magic[4];
+  ulittle32_t Version;
+  ulittle32_t SourceName; // string index
+  ulittle32_t NumStrings;
+  ulittle32_t StringDataSize;
+  ulittle32_t NumNodes;
+  ulittle32_t NumOperands;
+  ulittle32_t NumArgs;
+  ulittle32_t NumProtos;
+  ulittle32_t NumItems;
+};
+
+struct StringEntry {
+  ulittle32_t Offset;
+  ulittle32_t Size;
+};
+
+struct NodeRecord {
+  uint8_t Kind;
+  uint8_t Op;
+  uint8_t Reserved[2];
+  ulittle32_t Line;
+  ulittle32_t Col;
+  ulittle32_t Ops[3];
+  ulittle64_t Value;
+};
+
+struct ArgRecord {
+  ulittle32_t Name;
+  ulittle32_t Type;
+};
+
+struct ProtoRecord {
+  ulittle32_t Name;
+  ulittle32_t Line;
+  ulittle32_t RetType;
+  ulittle32_t FastMath;
+  ulittle32_t FirstArg;
+  ulittle32_t NumArgs;
+};
+
+struct ItemRecord {
+  ulittle32_t Kind; // TopLevelItem::ItemKind
+  ulittle32_t Proto;
+  ulittle32_t Body; // unused for externs
+};
+} // namespace kast
+
+/// ASTWriter - Flattens a program into the KAST format. The AST nodes append
+/// themselves through their serialize methods.
+class ASTWriter {
+  StringMap<uint32_t> StringIndex;
+  std::vector<kast::StringEntry> Strings;
+  std::string StringData;
+  std::vector<kast::NodeRecord> Nodes;
+  std::vector<kast::ulittle32_t> Operands;
+  std::vector<kast::ArgRecord> Args;
+  std::vector<kast::ProtoRecord> Protos;
+  std::vector<kast::ItemRecord> Items;
+  DenseMap<const ExprAST *, uint32_t> SharedIndex;
+  bool InSharedNode = false;
+
+public:
+  /// addString - Intern \p Str and return its string index.
+  uint32_t addString(StringRef Str);
+  /// addNode - Append a node record for \p AST and return its index.
+  uint32_t addNode(const ExprAST &AST, kast::NodeKind Kind, uint8_t Op = 0,
+                   uint32_t Op0 = 0, uint32_t Op1 = 0, uint32_t Op2 = 0,
+                   uint64_t Value = 0);
+  /// addSharedRef - Append a reference through \p Ref to the hash-consed
+  /// node \p Node, which is itself appended the first time it is seen, so the
+  /// DAG keeps its sharing on disk.
+  uint32_t addSharedRef(const SharedExprAST &Ref, const ExprAST &Node);
+  /// addOperands - Append a list of node indices and return where it starts.
+  uint32_t addOperands(ArrayRef<uint32_t> Ops);
+  uint32_t addPrototype(const PrototypeAST &Proto);
+  void addItem(const TopLevelItem &Item);
+
+  /// write - Emit the file, recording \p SourceName for the debug info.
+  void write(raw_ostream &OS, StringRef SourceName);
+};
+
+/// writeProgram - Serialize \p Items to the file \p Path. Returns false and
+/// reports the error if the file cannot be written.
+bool writeProgram(const std::vector<TopLevelItem> &Items, StringRef Path,
+                  StringRef SourceName);
+
+/// isSerializedAST - Whether \p Data starts with the KAST magic.
+bool isSerializedAST(StringRef Data);
+
+/// readProgram - Rebuild the items stored in the KAST image \p Data. Returns
+/// false and reports the problem if the image is malformed or has another
+/// version.
+bool readProgram(StringRef Data, std::vector<TopLevelItem> &Items,
+                 std::string &SourceName);
+
+#endif
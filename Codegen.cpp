@@ -1,52 +1,409 @@
-#include "AST.h"
-static LLVMContext *TheContext = new LLVMContext();
-static IRBuilder<> Builder(*TheContext);
-static std::unique_ptr<Module> TheModule =
-    std::make_unique<Module>("my cool jit", *TheContext);
+#include "Codegen.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+static std::unique_ptr<LLVMContext> TheContext;
+static std::unique_ptr<IRBuilder<>> Builder;
+static std::unique_ptr<Module> TheModule;
 static std::map<std::string, Value *> NamedValues;
+/// SharedValues - The value each hash-consed node already has in the current
+/// function. Only values whose block dominates the insertion point are kept:
+/// control flow saves and restores it around code that may not dominate.
+static std::map<const ExprAST *, Value *> SharedValues;
+std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+bool EnableFastMath = false;
 extern std::unique_ptr<ExprAST> LogError(const char *Str);
 
 Value *LogErrorV(const char *Str) {
   LogError(Str);
   return nullptr;
 }
+
+//===----------------------------------------------------------------------===//
+// Debug info
+//===----------------------------------------------------------------------===//
+
+// Line tables and subprograms let gdb (through its JIT interface) and perf
+// map JIT'd addresses back to the `def` and source line they came from.
+static std::unique_ptr<DIBuilder> DBuilder;
+
+struct DebugInfo {
+  DICompileUnit *TheCU = nullptr;
+  DIType *Types[ty_double_array + 1] = {};
+  std::vector<DIScope *> LexicalBlocks;
+  /// SharedLoc - While a hash-consed node is generated for an occurrence
+  /// other than its first, that occurrence. The node itself carries the
+  /// locations of the first occurrence, which may be in another function.
+  ExprAST *SharedLoc = nullptr;
+
+  void emitLocation(ExprAST *AST);
+  DIType *getType(TypeKind Ty);
+} KSDbgInfo;
+
+DIType *DebugInfo::getType(TypeKind Ty) {
+  if (Types[Ty])
+    return Types[Ty];
+
+  switch (Ty) {
+  case ty_bool:
+    Types[Ty] = DBuilder->createBasicType("bool", 8, dwarf::DW_ATE_boolean);
+    break;
+  case ty_int64:
+    Types[Ty] = DBuilder->createBasicType("int64", 64, dwarf::DW_ATE_signed);
+    break;
+  case ty_float32:
+    Types[Ty] = DBuilder->createBasicType("float32", 32, dwarf::DW_ATE_float);
+    break;
+  case ty_double:
+    Types[Ty] = DBuilder->createBasicType("double", 64, dwarf::DW_ATE_float);
+    break;
+  case ty_int64_array:
+  case ty_float32_array:
+  case ty_double_array:
+    Types[Ty] = DBuilder->createPointerType(getType(getElementType(Ty)), 64);
+    break;
+  }
+  return Types[Ty];
+}
+
+void DebugInfo::emitLocation(ExprAST *AST) {
+  if (!AST)
+    return Builder->SetCurrentDebugLocation(DebugLoc());
+  if (SharedLoc)
+    AST = SharedLoc;
+  DIScope *Scope;
+  if (LexicalBlocks.empty())
+    Scope = TheCU;
+  else
+    Scope = LexicalBlocks.back();
+  Builder->SetCurrentDebugLocation(DILocation::get(
+      Scope->getContext(), AST->getLine(), AST->getCol(), Scope));
+}
+
+static DISubroutineType *CreateFunctionType(const PrototypeAST &P,
+                                            unsigned NumArgs) {
+  SmallVector<Metadata *, 8> EltTys;
+
+  // Add the result type.
+  EltTys.push_back(KSDbgInfo.getType(P.getRetType()));
+
+  for (unsigned i = 0, e = NumArgs; i != e; ++i)
+    EltTys.push_back(KSDbgInfo.getType(P.getArgType(i)));
+
+  return DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(EltTys));
+}
+
+void InitializeModule(const std::string &SourceName) {
+  // Drop a module that was never handed to the JIT before its context.
+  DBuilder.reset();
+  Builder.reset();
+  TheModule.reset();
+  TheContext = std::make_unique<LLVMContext>();
+  TheModule = std::make_unique<Module>("my cool jit", *TheContext);
+  Builder = std::make_unique<IRBuilder<>>(*TheContext);
+
+  TheModule->addModuleFlag(Module::Warning, "Debug Info Version",
+                           DEBUG_METADATA_VERSION);
+  DBuilder = std::make_unique<DIBuilder>(*TheModule);
+  KSDbgInfo = DebugInfo();
+  KSDbgInfo.TheCU = DBuilder->createCompileUnit(
+      dwarf::DW_LANG_C, DBuilder->createFile(SourceName, "."),
+      "Kaleidoscope Compiler", false, "", 0);
+}
+
+orc::ThreadSafeModule TakeModule() {
+  DBuilder->finalize();
+  return orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+}
+
+/// getFunction - Find \p Name in the current module, or declare it from the
+/// last prototype seen for it.
+static Function *getFunction(std::string Name) {
+  if (auto *F = TheModule->getFunction(Name))
+    return F;
+
+  auto FI = FunctionProtos.find(Name);
+  if (FI != FunctionProtos.end())
+    return FI->second->codegen();
+
+  return nullptr;
+}
+
+/// MathBuiltin - A math library function that is emitted as an LLVM
+/// intrinsic, so the optimizer knows its semantics instead of seeing an
+/// opaque call.
+struct MathBuiltin {
+  const char *Name;
+  Intrinsic::ID ID;
+};
+
+static const MathBuiltin MathBuiltins[] = {
+    {"sqrt", Intrinsic::sqrt},
+    {"sin", Intrinsic::sin},
+    {"cos", Intrinsic::cos},
+    {"exp", Intrinsic::exp},
+    {"exp2", Intrinsic::exp2},
+    {"log", Intrinsic::log},
+    {"log2", Intrinsic::log2},
+    {"log10", Intrinsic::log10},
+    {"fabs", Intrinsic::fabs},
+    {"floor", Intrinsic::floor},
+    {"ceil", Intrinsic::ceil},
+    {"trunc", Intrinsic::trunc},
+    {"round", Intrinsic::round},
+    {"pow", Intrinsic::pow},
+    {"fmin", Intrinsic::minnum},
+    {"fmax", Intrinsic::maxnum},
+    {"copysign", Intrinsic::copysign},
+    {"fma", Intrinsic::fma},
+};
+
+//===----------------------------------------------------------------------===//
+// Types
+//===----------------------------------------------------------------------===//
+
+/// getLLVMType - The IR type that holds values of kind \p Ty.
+static Type *getLLVMType(TypeKind Ty) {
+  switch (Ty) {
+  case ty_bool:
+    return Type::getInt1Ty(*TheContext);
+  case ty_int64:
+    return Type::getInt64Ty(*TheContext);
+  case ty_float32:
+    return Type::getFloatTy(*TheContext);
+  case ty_double:
+    return Type::getDoubleTy(*TheContext);
+  case ty_int64_array:
+  case ty_float32_array:
+  case ty_double_array:
+    return getLLVMType(getElementType(Ty))->getPointerTo();
+  }
+  llvm_unreachable("unknown type kind");
+}
+
+/// getTypeKind - The kind of value an IR type holds; inverse of getLLVMType.
+static TypeKind getTypeKind(Type *T) {
+  if (T->isPointerTy())
+    return getArrayType(getTypeKind(T->getPointerElementType()));
+  if (T->isIntegerTy(1))
+    return ty_bool;
+  if (T->isIntegerTy())
+    return ty_int64;
+  if (T->isFloatTy())
+    return ty_float32;
+  return ty_double;
+}
+
+/// convertTo - Convert \p V to kind \p Ty. Bools widen to 0/1, integers are
+/// signed, and any scalar becomes a bool by comparing it against zero. Arrays
+/// do not convert; that is reported and null returned.
+static Value *convertTo(Value *V, TypeKind Ty, const Twine &Name = "convtmp") {
+  TypeKind From = getTypeKind(V->getType());
+  if (From == Ty)
+    return V;
+  if (isArrayType(From) || isArrayType(Ty))
+    return LogErrorV("arrays do not convert to other types");
+
+  Type *DestTy = getLLVMType(Ty);
+  if (Ty == ty_bool) {
+    if (From == ty_int64)
+      return Builder->CreateICmpNE(V, ConstantInt::get(V->getType(), 0), Name);
+    return Builder->CreateFCmpONE(V, ConstantFP::get(V->getType(), 0.0), Name);
+  }
+
+  switch (From) {
+  case ty_bool:
+    if (Ty == ty_int64)
+      return Builder->CreateZExt(V, DestTy, Name);
+    return Builder->CreateUIToFP(V, DestTy, Name);
+  case ty_int64:
+    return Builder->CreateSIToFP(V, DestTy, Name);
+  case ty_float32:
+  case ty_double:
+    if (Ty == ty_int64)
+      return Builder->CreateFPToSI(V, DestTy, Name);
+    return Builder->CreateFPCast(V, DestTy, Name);
+  default:
+    llvm_unreachable("arrays are rejected above");
+  }
+}
+
+bool isMathBuiltin(const std::string &Name) {
+  for (const MathBuiltin &B : MathBuiltins)
+    if (Name == B.Name)
+      return true;
+  return false;
+}
+
+/// getMathBuiltin - Declare the intrinsic behind the math builtin \p Name,
+/// overloaded on \p Ty, or return null if there is no such builtin. User
+/// prototypes take precedence, so this is only consulted for names the
+/// program has not declared.
+static Function *getMathBuiltin(const std::string &Name, TypeKind Ty) {
+  for (const MathBuiltin &B : MathBuiltins)
+    if (Name == B.Name)
+      return Intrinsic::getDeclaration(TheModule.get(), B.ID,
+                                       {getLLVMType(Ty)});
+  return nullptr;
+}
+
+//===----------------------------------------------------------------------===//
+// Code Generation
+//===----------------------------------------------------------------------===//
+
 Value *NumberExprAST::codegen() {
+  KSDbgInfo.emitLocation(this);
   return ConstantFP::get(*TheContext, APFloat(Val));
 }
+
+Value *IntegerExprAST::codegen() {
+  KSDbgInfo.emitLocation(this);
+  return ConstantInt::get(Type::getInt64Ty(*TheContext), Val, true);
+}
 Value *VariableExprAST::codegen() {
   // Look this variable up in the function.
+  KSDbgInfo.emitLocation(this);
   Value *V = NamedValues[Name];
   if (!V)
     LogErrorV("Unknown variable name");
   return V;
 }
 
+Value *SharedExprAST::codegen() {
+  auto It = SharedValues.find(Node.get());
+  if (It != SharedValues.end())
+    return It->second;
+
+  // The node's own locations are those of its first occurrence. Attribute
+  // the code of any other occurrence to that occurrence as a whole; a shared
+  // node nested in it is part of it.
+  ExprAST *OuterLoc = KSDbgInfo.SharedLoc;
+  if (!OuterLoc && (getLine() != Node->getLine() || getCol() != Node->getCol()))
+    KSDbgInfo.SharedLoc = this;
+  Value *V = Node->codegen();
+  KSDbgInfo.SharedLoc = OuterLoc;
+  if (V)
+    SharedValues[Node.get()] = V;
+  return V;
+}
+
+/// getElementAlign - Arrays are naturally aligned; see PrototypeAST::codegen.
+static Align getElementAlign(Type *ElemTy) {
+  return Align(ElemTy->getPrimitiveSizeInBits() / 8);
+}
+
+/// getElementAddress - Address of element \p Index of the array argument
+/// \p Name, or null after reporting an error.
+static Value *getElementAddress(const std::string &Name, ExprAST &Index) {
+  Value *Array = NamedValues[Name];
+  if (!Array)
+    return LogErrorV("Unknown variable name");
+  if (!isArrayType(getTypeKind(Array->getType())))
+    return LogErrorV("Only arrays can be indexed");
+
+  Value *Idx = Index.codegen();
+  if (!Idx)
+    return nullptr;
+  TypeKind IdxTy = getTypeKind(Idx->getType());
+  if (IdxTy != ty_int64 && IdxTy != ty_bool)
+    return LogErrorV("Array index must be an int64");
+  Idx = convertTo(Idx, ty_int64, "idx");
+
+  Type *ElemTy = Array->getType()->getPointerElementType();
+  return Builder->CreateInBoundsGEP(ElemTy, Array, Idx, Name + ".addr");
+}
+
+Value *IndexExprAST::codegen() {
+  Value *Addr = getElementAddress(Name, *Index);
+  if (!Addr)
+    return nullptr;
+
+  KSDbgInfo.emitLocation(this);
+  Type *ElemTy = Addr->getType()->getPointerElementType();
+  return Builder->CreateAlignedLoad(ElemTy, Addr, getElementAlign(ElemTy),
+                                    Name + ".elt");
+}
+
+Value *StoreExprAST::codegen() {
+  Value *Addr = getElementAddress(Name, *Index);
+  if (!Addr)
+    return nullptr;
+
+  Value *V = Val->codegen();
+  if (!V)
+    return nullptr;
+
+  KSDbgInfo.emitLocation(this);
+  Type *ElemTy = Addr->getType()->getPointerElementType();
+  V = convertTo(V, getTypeKind(ElemTy));
+  if (!V)
+    return nullptr;
+  Builder->CreateAlignedStore(V, Addr, getElementAlign(ElemTy));
+  return V;
+}
+
 Value *BinaryExprAST::codegen() {
   Value *L = LHS->codegen();
   Value *R = RHS->codegen();
   if (!L || !R)
     return nullptr;
+
+  KSDbgInfo.emitLocation(this);
+
+  // Bring both operands to their common type; bools take part as integers.
+  // A floating constant next to a float32 is narrowed rather than widening
+  // the whole expression to double.
+  TypeKind LTy = getTypeKind(L->getType());
+  TypeKind RTy = getTypeKind(R->getType());
+  if (isArrayType(LTy) || isArrayType(RTy))
+    return LogErrorV("arrays cannot be used as operands");
+  TypeKind Ty = std::max(std::max(LTy, RTy), ty_int64);
+  if (Ty == ty_double && ((LTy == ty_float32 && isa<ConstantFP>(R)) ||
+                          (RTy == ty_float32 && isa<ConstantFP>(L))))
+    Ty = ty_float32;
+  L = convertTo(L, Ty);
+  R = convertTo(R, Ty);
+  bool IsFP = Ty != ty_int64;
+
   switch (Op) {
   case '+':
     // 创建指令的IR
-    return Builder.CreateFAdd(L, R, "addtmp");
+    if (!IsFP)
+      return Builder->CreateAdd(L, R, "addtmp");
+    return Builder->CreateFAdd(L, R, "addtmp");
   case '-':
-    return Builder.CreateFSub(L, R, "subtmp");
+    if (!IsFP)
+      return Builder->CreateSub(L, R, "subtmp");
+    return Builder->CreateFSub(L, R, "subtmp");
   case '*':
-    return Builder.CreateFMul(L, R, "multmp");
+    if (!IsFP)
+      return Builder->CreateMul(L, R, "multmp");
+    return Builder->CreateFMul(L, R, "multmp");
   case '<':
-    L = Builder.CreateFCmpULT(L, R, "cmptmp");
-    // Convert bool 0/1 to double 0.0 or 1.0
-    return Builder.CreateUIToFP(L, Type::getDoubleTy(*TheContext), "booltmp");
+    // The result stays an i1 bool; it is only widened where it is used as a
+    // number.
+    if (!IsFP)
+      return Builder->CreateICmpSLT(L, R, "cmptmp");
+    return Builder->CreateFCmpULT(L, R, "cmptmp");
   default:
     return LogErrorV("invalid binary operator");
   }
 }
 
 Value *CallExprAST::codegen() {
+  std::vector<Value *> ArgsV;
+  bool AllFloat32 = !Args.empty();
+  for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+    ArgsV.push_back(Args[i]->codegen());
+    if (!ArgsV.back())
+      return nullptr;
+    AllFloat32 &= ArgsV.back()->getType()->isFloatTy();
+  }
 
-  // Look up the name in the global module table.
-  Function *CalleeF = TheModule->getFunction(Callee);
+  // Look up the name in the global module table. Math builtins use the
+  // float overload when every argument is float32.
+  Function *CalleeF = getFunction(Callee);
+  if (!CalleeF)
+    CalleeF = getMathBuiltin(Callee, AllFloat32 ? ty_float32 : ty_double);
   if (!CalleeF)
     return LogErrorV("Unknown function referenced");
 
@@ -54,25 +411,25 @@ Value *CallExprAST::codegen() {
   if (CalleeF->arg_size() != Args.size())
     return LogErrorV("Incorrect # arguments passed");
 
-  std::vector<Value *> ArgsV;
-  for (unsigned i = 0, e = Args.size(); i != e; ++i) {
-    ArgsV.push_back(Args[i]->codegen());
-    if (!ArgsV.back())
+  KSDbgInfo.emitLocation(this);
+  for (unsigned i = 0, e = ArgsV.size(); i != e; ++i) {
+    ArgsV[i] = convertTo(ArgsV[i], getTypeKind(CalleeF->getArg(i)->getType()));
+    if (!ArgsV[i])
       return nullptr;
   }
 
   // 函数调用使用的IR build指令
-  return Builder.CreateCall(CalleeF, ArgsV, "calltmp");
+  return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
 }
 
 // External一个函数时需要这个
 Function *PrototypeAST::codegen() {
   //首先需要创造一个函数类型
-  // FIXME: 这个Double是啥
-  std::vector<Type *> Doubles(Args.size(), Type::getDoublePtrTy(*TheContext));
+  std::vector<Type *> ParamTys;
+  for (TypeKind Ty : ArgTypes)
+    ParamTys.push_back(getLLVMType(Ty));
   //首先创造函数类型的声明
-  FunctionType *FT =
-      FunctionType::get(Type::getDoubleTy(*TheContext), Doubles, false);
+  FunctionType *FT = FunctionType::get(getLLVMType(RetType), ParamTys, false);
   //然后声明函数
   Function *F =
       Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get());
@@ -81,6 +438,19 @@ Function *PrototypeAST::codegen() {
   for (auto &Arg : F->args())
     Arg.setName(Args[Idx++]);
 
+  // Arrays are host buffers handed over for the duration of the call. The
+  // caller guarantees they do not overlap and are naturally aligned, which
+  // is what lets loops over them be vectorized.
+  for (unsigned i = 0, e = ArgTypes.size(); i != e; ++i) {
+    if (!isArrayType(ArgTypes[i]))
+      continue;
+    Type *ElemTy = getLLVMType(getElementType(ArgTypes[i]));
+    F->addParamAttr(i, Attribute::NoAlias);
+    F->addParamAttr(i, Attribute::NoCapture);
+    F->addParamAttr(i, Attribute::getWithAlignment(*TheContext,
+                                                   getElementAlign(ElemTy)));
+  }
+
   return F;
 }
 
@@ -88,10 +458,11 @@ Function *PrototypeAST::codegen() {
 Function *FunctionAST::codegen() {
   //这里会引入BasicBlock的概念
   // First step : 先判断function的合法性
-  Function *TheFunction = TheModule->getFunction(Proto->getName());
-
-  if (!TheFunction)
-    TheFunction = Proto->codegen();
+  // Transfer ownership of the prototype to the FunctionProtos map, but keep a
+  // reference to it for use below.
+  auto &P = *Proto;
+  FunctionProtos[Proto->getName()] = std::move(Proto);
+  Function *TheFunction = getFunction(P.getName());
 
   if (!TheFunction)
     return nullptr;
@@ -102,18 +473,68 @@ Function *FunctionAST::codegen() {
   // Create a new basic block to start insertation into
   BasicBlock *BB =
       BasicBlock::Create(*TheContext, "entry", TheFunction); // TheFunction是
-  Builder.SetInsertPoint(BB); // 这里的意思就是后面的指令必须排在这个基本块后面
+  Builder->SetInsertPoint(BB); // 这里的意思就是后面的指令必须排在这个基本块后面
+
+  // Create a subprogram DIE for this function.
+  DIFile *Unit = DBuilder->createFile(KSDbgInfo.TheCU->getFilename(),
+                                      KSDbgInfo.TheCU->getDirectory());
+  DIScope *FContext = Unit;
+  unsigned LineNo = P.getLine();
+  unsigned ScopeLine = LineNo;
+  DISubprogram *SP = DBuilder->createFunction(
+      FContext, P.getName(), StringRef(), Unit, LineNo,
+      CreateFunctionType(P, TheFunction->arg_size()), ScopeLine,
+      DINode::FlagPrototyped, DISubprogram::SPFlagDefinition);
+  TheFunction->setSubprogram(SP);
+
+  // Push the current scope.
+  KSDbgInfo.LexicalBlocks.push_back(SP);
+
+  // Every FP instruction the builder creates for this body picks up these
+  // flags: reassoc lets reductions be vectorized, contract allows FMA
+  // formation, nnan drops NaN-preserving checks.
+  FastMathFlags FMF;
+  if (EnableFastMath || P.isFastMath()) {
+    FMF.setAllowReassoc();
+    FMF.setAllowContract();
+    FMF.setNoNaNs();
+  }
+  Builder->setFastMathFlags(FMF);
+
+  // Unset the location for the prologue emission (leading instructions with no
+  // location in a function are considered part of the prologue and the
+  // debugger will run past them when breaking on a function)
+  KSDbgInfo.emitLocation(nullptr);
 
   // Validate the generated code, checking for consistency
   NamedValues.clear();
+  SharedValues.clear();
 
+  unsigned ArgIdx = 0;
   for (auto &Arg : TheFunction->args()) {
+    // Describe the argument so the debugger can show it; it lives in an SSA
+    // value rather than a stack slot, hence dbg.value.
+    DILocalVariable *D = DBuilder->createParameterVariable(
+        SP, Arg.getName(), ArgIdx + 1, Unit, LineNo,
+        KSDbgInfo.getType(P.getArgType(ArgIdx)), true);
+    ++ArgIdx;
+    DBuilder->insertDbgValueIntrinsic(
+        &Arg, D, DBuilder->createExpression(),
+        DILocation::get(SP->getContext(), LineNo, 0, SP),
+        Builder->GetInsertBlock());
+
     NamedValues[static_cast<std::string>(Arg.getName())] = &Arg;
   }
 
-  if (Value *RetVal = Body->codegen()) {
+  Value *RetVal = Body->codegen();
+  if (RetVal)
+    RetVal = convertTo(RetVal, P.getRetType());
+  if (RetVal) {
     // Finish off the function.
-    Builder.CreateRet(RetVal);
+    Builder->CreateRet(RetVal);
+
+    // Pop off the lexical block for the function.
+    KSDbgInfo.LexicalBlocks.pop_back();
 
     // Validate the generated code, checking for consistency.
     verifyFunction(*TheFunction);
@@ -123,6 +544,10 @@ Function *FunctionAST::codegen() {
 
   // Error reading body, remove function.
   TheFunction->eraseFromParent();
+
+  // Pop off the lexical block for the function since we added it
+  // unconditionally.
+  KSDbgInfo.LexicalBlocks.pop_back();
   return nullptr;
 }
 
@@ -131,10 +556,13 @@ Value *IfExprAST::codegen() {
   if (!CondV)
     return nullptr;
 
-  // Convert condition to a bool by comparing non-equal to 0.0.
-  CondV = Builder.CreateFCmpONE(
-      CondV, ConstantFP::get(*TheContext, APFloat(0.0)), "ifcond");
-  Function *TheFunction = Builder.GetInsertBlock()->getParent();
+  KSDbgInfo.emitLocation(this);
+  // Convert condition to a bool by comparing non-equal to 0; comparisons are
+  // already bools and branch on directly.
+  CondV = convertTo(CondV, ty_bool, "ifcond");
+  if (!CondV)
+    return nullptr;
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
   // Create blocks for the then and else cases.  Insert the 'then' block at the
   // end of the function.
@@ -142,34 +570,176 @@ Value *IfExprAST::codegen() {
   BasicBlock *ElseBB = BasicBlock::Create(*TheContext, "else");
   BasicBlock *MergeBB = BasicBlock::Create(*TheContext, "ifcont");
 
-  Builder.CreateCondBr(CondV, ThenBB, ElseBB);
+  Builder->CreateCondBr(CondV, ThenBB, ElseBB);
+
+  // Shared values computed in one arm dominate neither the other arm nor the
+  // merge block.
+  auto OuterSharedValues = SharedValues;
+
   // Emit then value.
-  Builder.SetInsertPoint(ThenBB);
+  Builder->SetInsertPoint(ThenBB);
 
   Value *ThenV = Then->codegen();
   if (!ThenV)
     return nullptr;
 
-  Builder.CreateBr(MergeBB);
   // Codegen of 'Then' can change the current block, update ThenBB for the PHI.
-  ThenBB = Builder.GetInsertBlock();
+  // Its branch to the merge block is emitted once the result type is known.
+  ThenBB = Builder->GetInsertBlock();
   // Emit else block.
   TheFunction->getBasicBlockList().push_back(ElseBB);
-  Builder.SetInsertPoint(ElseBB);
+  Builder->SetInsertPoint(ElseBB);
+  SharedValues = OuterSharedValues;
 
   Value *ElseV = Else->codegen();
   if (!ElseV)
     return nullptr;
 
-  Builder.CreateBr(MergeBB);
   // codegen of 'Else' can change the current block, update ElseBB for the PHI.
-  ElseBB = Builder.GetInsertBlock();
+  ElseBB = Builder->GetInsertBlock();
+  SharedValues = OuterSharedValues;
+
+  // Both arms yield the wider of their two types.
+  TypeKind Ty = std::max(getTypeKind(ThenV->getType()),
+                         getTypeKind(ElseV->getType()));
+  ElseV = convertTo(ElseV, Ty);
+  Builder->CreateBr(MergeBB);
+  Builder->SetInsertPoint(ThenBB);
+  ThenV = convertTo(ThenV, Ty);
+  Builder->CreateBr(MergeBB);
+  if (!ThenV || !ElseV)
+    return nullptr;
+
   // Emit merge block.
   TheFunction->getBasicBlockList().push_back(MergeBB);
-  Builder.SetInsertPoint(MergeBB);
-  PHINode *PN = Builder.CreatePHI(Type::getDoubleTy(*TheContext), 2, "iftmp");
+  Builder->SetInsertPoint(MergeBB);
+  PHINode *PN = Builder->CreatePHI(getLLVMType(Ty), 2, "iftmp");
 
   PN->addIncoming(ThenV, ThenBB);
   PN->addIncoming(ElseV, ElseBB);
   return PN;
-}
\ No newline at end of file
+}
+// Output for-loop as:
+//   preheader:
+//     start = startexpr
+//     end = endexpr
+//     br (start < end), loop, afterloop
+//   loop:
+//     variable = phi [start, preheader], [nextvariable, loopend]
+//     ...
+//     bodyexpr
+//     ...
+//   loopend:
+//     nextvariable = variable + step
+//     br (nextvariable < end), loop, afterloop
+//   afterloop:
+// Start and End are evaluated once, so the trip count is known on entry.
+Value *ForExprAST::codegen() {
+  Value *StartVal = Start->codegen();
+  if (!StartVal)
+    return nullptr;
+  Value *EndVal = End->codegen();
+  if (!EndVal)
+    return nullptr;
+
+  // The step value defaults to 1.
+  Value *StepVal = nullptr;
+  if (Step) {
+    StepVal = Step->codegen();
+    if (!StepVal)
+      return nullptr;
+  } else {
+    StepVal = ConstantInt::get(Type::getInt64Ty(*TheContext), 1);
+  }
+
+  KSDbgInfo.emitLocation(this);
+  StartVal = convertTo(StartVal, ty_int64);
+  EndVal = convertTo(EndVal, ty_int64);
+  StepVal = convertTo(StepVal, ty_int64);
+  if (!StartVal || !EndVal || !StepVal)
+    return nullptr;
+
+  // The loop runs while the variable is below the end for a positive step,
+  // and above it for a negative one. A step only known at run time picks
+  // the test then, and makes no iterations if it is zero.
+  auto *ConstStep = dyn_cast<ConstantInt>(StepVal);
+  if (ConstStep && ConstStep->isZero())
+    return LogErrorV("for loop step must not be zero");
+  auto InRange = [&](Value *I, const Twine &Name) -> Value * {
+    if (ConstStep)
+      return ConstStep->isNegative() ? Builder->CreateICmpSGT(I, EndVal, Name)
+                                     : Builder->CreateICmpSLT(I, EndVal, Name);
+    Value *Zero = ConstantInt::get(StepVal->getType(), 0);
+    Value *Up = Builder->CreateAnd(Builder->CreateICmpSGT(StepVal, Zero),
+                                   Builder->CreateICmpSLT(I, EndVal));
+    Value *Down = Builder->CreateAnd(Builder->CreateICmpSLT(StepVal, Zero),
+                                     Builder->CreateICmpSGT(I, EndVal));
+    return Builder->CreateOr(Up, Down, Name);
+  };
+
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  BasicBlock *PreheaderBB = Builder->GetInsertBlock();
+  BasicBlock *LoopBB = BasicBlock::Create(*TheContext, "loop", TheFunction);
+  BasicBlock *AfterBB = BasicBlock::Create(*TheContext, "afterloop");
+
+  Value *EnterCond = InRange(StartVal, "loopenter");
+  Builder->CreateCondBr(EnterCond, LoopBB, AfterBB);
+
+  // Start the PHI node with an entry for Start.
+  Builder->SetInsertPoint(LoopBB);
+  PHINode *Variable =
+      Builder->CreatePHI(Type::getInt64Ty(*TheContext), 2, VarName);
+  Variable->addIncoming(StartVal, PreheaderBB);
+
+  // Within the loop, the variable is defined equal to the PHI node.  If it
+  // shadows an existing variable, we have to restore it, so save it now.
+  Value *OldVal = NamedValues[VarName];
+  NamedValues[VarName] = Variable;
+
+  // Values from the body do not dominate the code after the loop, and shared
+  // nodes naming the loop variable mean something else inside it, so the
+  // body starts without any shared values.
+  auto OuterSharedValues = std::move(SharedValues);
+  SharedValues.clear();
+
+  // Emit the body of the loop. Its value is ignored, but don't allow an
+  // error.
+  if (!Body->codegen())
+    return nullptr;
+  SharedValues = std::move(OuterSharedValues);
+
+  // A step of 1 or -1 cannot overflow past an end that is in range; any
+  // other step stops the loop if it would.
+  KSDbgInfo.emitLocation(this);
+  Value *NextVar, *EndCond;
+  if (ConstStep && ConstStep->getValue().abs().isOne()) {
+    NextVar = Builder->CreateAdd(Variable, StepVal, "nextvar", false,
+                                 /*HasNSW=*/true);
+    EndCond = InRange(NextVar, "loopcond");
+  } else {
+    Value *Sum = Builder->CreateBinaryIntrinsic(Intrinsic::sadd_with_overflow,
+                                                Variable, StepVal);
+    NextVar = Builder->CreateExtractValue(Sum, 0, "nextvar");
+    Value *Overflow = Builder->CreateExtractValue(Sum, 1);
+    EndCond = Builder->CreateAnd(Builder->CreateNot(Overflow),
+                                 InRange(NextVar, ""), "loopcond");
+  }
+
+  // Create the "after loop" block and insert it.
+  BasicBlock *LoopEndBB = Builder->GetInsertBlock();
+  Builder->CreateCondBr(EndCond, LoopBB, AfterBB);
+  TheFunction->getBasicBlockList().push_back(AfterBB);
+  Builder->SetInsertPoint(AfterBB);
+
+  // Add a new entry to the PHI node for the backedge.
+  Variable->addIncoming(NextVar, LoopEndBB);
+
+  // Restore the unshadowed variable.
+  if (OldVal)
+    NamedValues[VarName] = OldVal;
+  else
+    NamedValues.erase(VarName);
+
+  // for expr always returns 0.0.
+  return Constant::getNullValue(Type::getDoubleTy(*TheContext));
+}
@@ -0,0 +1,26 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "AST.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+
+/// FunctionProtos - The most recent prototype for each function, so calls can
+/// be emitted into a module other than the one holding the definition.
+extern std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+
+/// EnableFastMath - Emit every function as if it were declared `fastmath`.
+extern bool EnableFastMath;
+
+/// isMathBuiltin - Whether \p Name is lowered to an intrinsic when the
+/// program does not declare it itself.
+bool isMathBuiltin(const std::string &Name);
+
+/// InitializeModule - Start a fresh context and module for the next piece of
+/// top-level code. \p SourceName is the file recorded in the debug info.
+void InitializeModule(const std::string &SourceName);
+
+/// TakeModule - Finalize the debug info of the current module and hand it
+/// over, together with its context, ready to be added to the JIT.
+orc::ThreadSafeModule TakeModule();
+
+#endif
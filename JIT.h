@@ -0,0 +1,256 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Target/TargetMachine.h"
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+/// PerfMapListener - Writes every JIT'd function to /tmp/perf-<pid>.map, the
+/// file `perf report` reads to name addresses in anonymous executable memory.
+/// Unlike jitdump it needs no `perf inject` step.
+class PerfMapListener : public JITEventListener {
+  std::mutex Mutex;
+  std::string Path;
+  FILE *MapFile = nullptr;
+
+  void open() {
+    Path = "/tmp/perf-" + std::to_string(sys::Process::getProcessId()) + ".map";
+    MapFile = fopen(Path.c_str(), "w");
+    if (!MapFile)
+      fprintf(stderr, "Warning: cannot open %s\n", Path.c_str());
+  }
+
+public:
+  PerfMapListener() { open(); }
+  ~PerfMapListener() {
+    if (MapFile)
+      fclose(MapFile);
+  }
+
+  /// reopen - Move to the map file of the current process after a fork,
+  /// since perf looks for the file by pid. Code compiled before the fork is
+  /// still mapped at the same addresses, so its entries are copied over.
+  void reopen() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::string ParentPath = Path;
+    if (MapFile)
+      fclose(MapFile);
+    open();
+    if (!MapFile)
+      return;
+    if (FILE *Parent = fopen(ParentPath.c_str(), "r")) {
+      char Buf[4096];
+      while (size_t N = fread(Buf, 1, sizeof(Buf), Parent))
+        fwrite(Buf, 1, N, MapFile);
+      fclose(Parent);
+      fflush(MapFile);
+    }
+  }
+
+  void notifyObjectLoaded(ObjectKey K, const object::ObjectFile &Obj,
+                          const RuntimeDyld::LoadedObjectInfo &L) override {
+    if (!MapFile)
+      return;
+
+    // The debug copy of the object has its sections relocated to the
+    // addresses they were loaded at.
+    object::OwningBinary<object::ObjectFile> DebugObjOwner =
+        L.getObjectForDebug(Obj);
+    const object::ObjectFile *DebugObj = DebugObjOwner.getBinary();
+    if (!DebugObj)
+      return;
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    for (const auto &P : object::computeSymbolSizes(*DebugObj)) {
+      object::SymbolRef Sym = P.first;
+      Expected<object::SymbolRef::Type> SymTypeOrErr = Sym.getType();
+      if (!SymTypeOrErr) {
+        consumeError(SymTypeOrErr.takeError());
+        continue;
+      }
+      if (*SymTypeOrErr != object::SymbolRef::ST_Function)
+        continue;
+
+      Expected<StringRef> NameOrErr = Sym.getName();
+      Expected<uint64_t> AddrOrErr = Sym.getAddress();
+      if (!NameOrErr || !AddrOrErr) {
+        consumeError(NameOrErr.takeError());
+        consumeError(AddrOrErr.takeError());
+        continue;
+      }
+      fprintf(MapFile, "%" PRIx64 " %" PRIx64 " %s\n", *AddrOrErr, P.second,
+              NameOrErr->str().c_str());
+    }
+    fflush(MapFile);
+  }
+};
+
+/// ToyJIT - LLJIT configured so that the code it produces is visible to
+/// debuggers and profilers. Objects are always registered with gdb's JIT
+/// interface; with profiling enabled they are also reported to perf, both as
+/// a perf map file and through LLVM's jitdump writer (when LLVM was built
+/// with perf support). Modules run through the O2 pipeline for the host
+/// before they are compiled.
+class ToyJIT {
+  std::unique_ptr<PerfMapListener> PerfMap;
+  orc::RTDyldObjectLinkingLayer *ObjLayer = nullptr;
+  bool JITDumpDeferred = false;
+  std::unique_ptr<TargetMachine> TM;
+  std::unique_ptr<orc::LLJIT> J;
+  /// Dylib - Where modules are added and names looked up: the main JITDylib,
+  /// or the scratch one while it exists.
+  orc::JITDylib *Dylib = nullptr;
+  unsigned NumScratchDylibs = 0;
+
+  ToyJIT() {}
+
+  /// optimizeModule - Run the default O2 pipeline. The host target machine
+  /// gives the vectorizers a real cost model.
+  static void optimizeModule(Module &M, TargetMachine *TM) {
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassBuilder PB(TM);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM =
+        PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+    MPM.run(M, MAM);
+  }
+
+public:
+  /// Create - With \p WillFork, the process is going to fork children that
+  /// compile code of their own; they must call reopenProfilingAfterFork.
+  static Expected<std::unique_ptr<ToyJIT>> Create(bool EnableProfiling,
+                                                  bool WillFork = false) {
+    std::unique_ptr<ToyJIT> JIT(new ToyJIT());
+
+    std::vector<JITEventListener *> Listeners;
+    Listeners.push_back(JITEventListener::createGDBRegistrationListener());
+    if (EnableProfiling) {
+      JIT->PerfMap = std::make_unique<PerfMapListener>();
+      Listeners.push_back(JIT->PerfMap.get());
+      // LLVM opens the jitdump file, named after the pid, only once per
+      // process, so a forking process leaves it to its children.
+      if (WillFork)
+        JIT->JITDumpDeferred = true;
+      else if (auto *PerfJIT = JITEventListener::createPerfJITEventListener())
+        Listeners.push_back(PerfJIT);
+    }
+
+    ToyJIT *Self = JIT.get();
+    auto J =
+        orc::LLJITBuilder()
+            .setObjectLinkingLayerCreator(
+                [Listeners, Self](orc::ExecutionSession &ES, const Triple &TT)
+                    -> Expected<std::unique_ptr<orc::ObjectLayer>> {
+                  auto ObjLayer = std::make_unique<orc::RTDyldObjectLinkingLayer>(
+                      ES, []() { return std::make_unique<SectionMemoryManager>(); });
+                  for (auto *L : Listeners)
+                    ObjLayer->registerJITEventListener(*L);
+                  Self->ObjLayer = ObjLayer.get();
+                  return std::move(ObjLayer);
+                })
+            .create();
+    if (!J)
+      return J.takeError();
+    JIT->J = std::move(*J);
+    JIT->Dylib = &JIT->J->getMainJITDylib();
+
+    auto JTMB = orc::JITTargetMachineBuilder::detectHost();
+    if (!JTMB)
+      return JTMB.takeError();
+    auto TM = JTMB->createTargetMachine();
+    if (!TM)
+      return TM.takeError();
+    JIT->TM = std::move(*TM);
+
+    TargetMachine *HostTM = JIT->TM.get();
+    JIT->J->getIRTransformLayer().setTransform(
+        [HostTM](orc::ThreadSafeModule TSM,
+                 const orc::MaterializationResponsibility &R)
+            -> Expected<orc::ThreadSafeModule> {
+          TSM.withModuleDo([HostTM](Module &M) { optimizeModule(M, HostTM); });
+          return std::move(TSM);
+        });
+
+    // Let `extern` declarations resolve to symbols in the host process.
+    auto Gen = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        JIT->J->getDataLayout().getGlobalPrefix());
+    if (!Gen)
+      return Gen.takeError();
+    JIT->J->getMainJITDylib().addGenerator(std::move(*Gen));
+
+    return std::move(JIT);
+  }
+
+  /// reopenProfilingAfterFork - Report the code this forked child compiles
+  /// to perf under its own pid: a perf map file of its own, and the jitdump
+  /// file the parent left unopened.
+  void reopenProfilingAfterFork() {
+    if (PerfMap)
+      PerfMap->reopen();
+    if (JITDumpDeferred) {
+      JITDumpDeferred = false;
+      if (auto *PerfJIT = JITEventListener::createPerfJITEventListener())
+        ObjLayer->registerJITEventListener(*PerfJIT);
+    }
+  }
+
+  const DataLayout &getDataLayout() const { return J->getDataLayout(); }
+
+  orc::JITDylib &getMainJITDylib() { return J->getMainJITDylib(); }
+  orc::JITDylib &getDylib() { return *Dylib; }
+
+  /// beginScratch - Send the following modules to a new JITDylib that sees
+  /// everything in the main one, and may redefine it, until endScratch
+  /// throws it away together with all the code added to it.
+  Error beginScratch() {
+    auto JD =
+        J->createJITDylib("scratch" + std::to_string(NumScratchDylibs++));
+    if (!JD)
+      return JD.takeError();
+    JD->addToLinkOrder(J->getMainJITDylib());
+    Dylib = &*JD;
+    return Error::success();
+  }
+
+  Error endScratch() {
+    orc::JITDylib *Scratch = Dylib;
+    Dylib = &J->getMainJITDylib();
+    return J->getExecutionSession().removeJITDylib(*Scratch);
+  }
+
+  Error addModule(orc::ThreadSafeModule TSM,
+                  orc::ResourceTrackerSP RT = nullptr) {
+    if (!RT)
+      RT = Dylib->getDefaultResourceTracker();
+    return J->addIRModule(RT, std::move(TSM));
+  }
+
+  Expected<JITEvaluatedSymbol> lookup(StringRef Name) {
+    return J->lookup(*Dylib, Name);
+  }
+};
+
+#endif
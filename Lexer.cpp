@@ -1,17 +1,40 @@
 #include "Lexer.h"
+#include <cerrno>
 
 void Lexer::init(std::string Content) {
   CurBuf = Content;
   CurPtr = &*CurBuf.cbegin();
+  TokStart = CurPtr;
+  LocPtr = LocLineStart = CurPtr;
+  LocLine = 1;
+}
+
+SourceLocation Lexer::getLoc(const char *Ptr) {
+  // Rewind if asked about an earlier position than the last one.
+  if (Ptr < LocPtr) {
+    LocPtr = LocLineStart = &*CurBuf.cbegin();
+    LocLine = 1;
+  }
+  for (; LocPtr < Ptr; ++LocPtr) {
+    if (*LocPtr == '\n') {
+      ++LocLine;
+      LocLineStart = LocPtr + 1;
+    }
+  }
+  SourceLocation Loc;
+  Loc.Line = LocLine;
+  Loc.Col = Ptr - LocLineStart + 1;
+  return Loc;
 }
 
 Token Lexer::lexToken() {
   char LastChar = ' ';
-  TokStart = CurPtr;
   // Skip any whiteSpace
   while (isspace(LastChar))
     // getchar is std function
     LastChar = getNextChar();
+  // The token starts at the character just read (EOF does not advance).
+  TokStart = LastChar == EOF ? CurPtr : CurPtr - 1;
 
   // Judge string identifier
   if (isalpha(LastChar)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
@@ -20,7 +43,8 @@ Token Lexer::lexToken() {
 
       IdentifierStr += LastChar;
     }
-    if(CurPtr - TokStart >= 2)
+    // Give back the lookahead character; EOF has already been given back.
+    if (LastChar != EOF)
       CurPtr--;
     if (IdentifierStr == "def")
       return tok_def;
@@ -32,17 +56,32 @@ Token Lexer::lexToken() {
       return tok_then;
     if (IdentifierStr == "else")
       return tok_else;
+    if (IdentifierStr == "for")
+      return tok_for;
+    if (IdentifierStr == "in")
+      return tok_in;
     return tok_identifier;
   }
 
   // Judge number identifier
-  if (isdigit(LastChar) || LastChar == '.') { // Number: [0-9.]+
+  // Number: [0-9.]+, an integer when it has no '.'
+  if (isdigit(LastChar) || LastChar == '.') {
     std::string NumStr;
     do {
       NumStr += LastChar;
       LastChar = getNextChar();
     } while (isdigit(LastChar) || LastChar == '.');
+    if (LastChar != EOF)
+      CurPtr--;
 
+    // A literal too large for an int64 stays a double, as it was before
+    // integers existed.
+    if (NumStr.find('.') == std::string::npos) {
+      errno = 0;
+      IntVal = strtoll(NumStr.c_str(), 0, 10);
+      if (errno != ERANGE)
+        return tok_integer;
+    }
     NumVal = strtod(NumStr.c_str(), 0);
     return tok_number;
   }
@@ -66,5 +105,5 @@ Token Lexer::lexToken() {
   if (LastChar == ')')
     return tok_rightParen;
   // Otherwise, just return the character as its ascii value.
-  return tok_unknown;
+  return Token((unsigned char)LastChar);
 }
@@ -6,7 +6,7 @@
 #include <string>
 #include <iostream>
 // Def basic tokens for
-enum Token {
+enum Token : int {
   tok_eof = -1,
   // commands
   tok_def = -2,
@@ -24,7 +24,14 @@ enum Token {
   tok_else = -10,
 
   // unkown token
-  tok_unknown = -11
+  tok_unknown = -11,
+
+  // integer literal (a number without '.')
+  tok_integer = -12,
+
+  // loops
+  tok_for = -13,
+  tok_in = -14
 };
 
 class Lexer {
@@ -35,12 +42,21 @@ public:
   // Declare a double val to store a number val
   double NumVal;
 
+  // Value of the last tok_integer
+  int64_t IntVal;
+
   const char *CurPtr = nullptr;
   std::string CurBuf;
 
   /// Information about the current token
   const char *TokStart = nullptr;
 
+  /// Cursor used by getLoc to turn buffer pointers into line/column pairs.
+  /// Tokens are located in order, so the buffer is only scanned once.
+  const char *LocPtr = nullptr;
+  const char *LocLineStart = nullptr;
+  int LocLine = 1;
+
   Token CurTok;
 
   char CurChar;
@@ -52,6 +68,11 @@ public:
     return CurTok = lexToken();
   }
   void init(std::string Content);
+
+  /// getLoc - Return the source location of \p Ptr in the current buffer.
+  SourceLocation getLoc(const char *Ptr);
+  /// getTokLoc - Return the source location of the current token.
+  SourceLocation getTokLoc() { return getLoc(TokStart); }
   char getNextChar() {
     CurChar = *CurPtr++;
     // cout << CurChar << int(CurChar) << endl;
@@ -1,5 +1,10 @@
 
 #include "Parser.h"
+#include "Codegen.h"
+#include <cstring>
+
+static ExitOnError ExitOnErr;
+
 /// BinopPrecedence - This holds the precedence for each binary operator that is
 /// defined.
 std::map<char, int> BinopPrecedence;
@@ -16,9 +21,12 @@ int Parser::lexPrecedence() {
   return TokPrec;
 }
 
+unsigned NumErrors = 0;
+
 /// LogError* - These are little helper functions for error handling.
 std::unique_ptr<ExprAST> LogError(const char *Str) {
   fprintf(stderr, "Error: %s\n", Str);
+  ++NumErrors;
   return nullptr;
 }
 
@@ -27,11 +35,55 @@ std::unique_ptr<PrototypeAST> LogErrorP(const char *Str) {
   return nullptr;
 }
 
+/// share - With hash-consing on, replace \p E by a reference to the canonical
+/// node for \p Key, which \p E becomes if it is the first of its kind. The
+/// key must identify E's structure, naming its children by their IDs.
+std::unique_ptr<ExprAST> Parser::share(const std::string &Key,
+                                       std::unique_ptr<ExprAST> E) {
+  if (!HashCons)
+    return E;
+
+  SourceLocation Loc;
+  Loc.Line = E->getLine();
+  Loc.Col = E->getCol();
+  auto It = SharedNodes.find(Key);
+  if (It == SharedNodes.end()) {
+    unsigned ID = SharedNodes.size();
+    It = SharedNodes
+             .insert(std::make_pair(
+                 Key, std::make_pair(std::shared_ptr<ExprAST>(std::move(E)), ID)))
+             .first;
+  }
+  return std::make_unique<SharedExprAST>(Loc, It->second.first,
+                                         It->second.second);
+}
+
+/// appendSharedID - Add the ID of \p E to a hash-cons key. Fails when E is
+/// not shared, which means it is not pure and neither is its parent.
+static bool appendSharedID(std::string &Key, const ExprAST &E) {
+  const SharedExprAST *S = E.getShared();
+  if (!S)
+    return false;
+  Key += ',';
+  Key += std::to_string(S->getID());
+  return true;
+}
+
 /// numberexpr ::= number
 std::unique_ptr<ExprAST> Parser::ParseNumberExpr() {
-  auto Result = std::make_unique<NumberExprAST>(Lex.NumVal);
+  uint64_t Bits;
+  memcpy(&Bits, &Lex.NumVal, sizeof(Bits));
+  auto Result = std::make_unique<NumberExprAST>(Lex.getTokLoc(), Lex.NumVal);
   Lex.lex(); // consume the number
-  return std::move(Result);
+  return share("n" + std::to_string(Bits), std::move(Result));
+}
+
+/// integerexpr ::= integer
+std::unique_ptr<ExprAST> Parser::ParseIntegerExpr() {
+  int64_t Val = Lex.IntVal;
+  auto Result = std::make_unique<IntegerExprAST>(Lex.getTokLoc(), Val);
+  Lex.lex(); // consume the integer
+  return share("i" + std::to_string(Val), std::move(Result));
 }
 
 /// parenexpr ::= '(' expression ')'
@@ -41,7 +93,7 @@ std::unique_ptr<ExprAST> Parser::ParseParenExpr() {
   if (!V)
     return nullptr;
 
-  if (Lex.CurTok != ')')
+  if (Lex.CurTok != tok_rightParen)
     return LogError("expected ')'");
   Lex.lex(); // eat ).
   return V;
@@ -49,14 +101,39 @@ std::unique_ptr<ExprAST> Parser::ParseParenExpr() {
 
 /// identifierexpr
 ///   ::= identifier
+///   ::= identifier '[' expression ']'
+///   ::= identifier '[' expression ']' '=' expression
 ///   ::= identifier '(' expression* ')'
 std::unique_ptr<ExprAST> Parser::ParseIdentifierExpr() {
   std::string IdName = Lex.IdentifierStr;
+  SourceLocation IdLoc = Lex.getTokLoc();
 
   Lex.lex(); // eat identifier.
 
+  // Array element load or store.
+  if (Lex.CurTok == '[') {
+    Lex.lex(); // eat [
+    auto Index = ParseExpression();
+    if (!Index)
+      return nullptr;
+    if (Lex.CurTok != ']')
+      return LogError("expected ']'");
+    Lex.lex(); // eat ]
+
+    if (Lex.CurTok != '=')
+      return std::make_unique<IndexExprAST>(IdLoc, IdName, std::move(Index));
+
+    Lex.lex(); // eat =
+    auto Val = ParseExpression();
+    if (!Val)
+      return nullptr;
+    return std::make_unique<StoreExprAST>(IdLoc, IdName, std::move(Index),
+                                          std::move(Val));
+  }
+
   if (Lex.CurTok != tok_leftParen) // Simple variable ref.
-    return std::make_unique<VariableExprAST>(IdName);
+    return share("v" + IdName,
+                 std::make_unique<VariableExprAST>(IdLoc, IdName));
 
   // Call.
   Lex.lex(); // eat (
@@ -80,12 +157,24 @@ std::unique_ptr<ExprAST> Parser::ParseIdentifierExpr() {
   // Eat the ')'.
   Lex.lex();
 
-  return std::make_unique<CallExprAST>(IdName, std::move(Args));
+  // Of all calls only those to math builtins are known to be pure.
+  std::string Key = "c" + IdName;
+  bool Pure = isMathBuiltin(IdName) && !DeclaredNames.count(IdName);
+  for (auto &Arg : Args)
+    Pure = Pure && appendSharedID(Key, *Arg);
+
+  auto Call = std::make_unique<CallExprAST>(IdLoc, IdName, std::move(Args));
+  if (!Pure)
+    return std::move(Call);
+  return share(Key, std::move(Call));
 }
 
 /// primary
 ///   ::= identifierexpr
 ///   ::= numberexpr
+///   ::= integerexpr
+///   ::= ifexpr
+///   ::= forexpr
 ///   ::= parenexpr
 std::unique_ptr<ExprAST> Parser::ParsePrimary() {
   switch (Lex.CurTok) {
@@ -95,9 +184,13 @@ std::unique_ptr<ExprAST> Parser::ParsePrimary() {
     return ParseIdentifierExpr();
   case tok_number:
     return ParseNumberExpr();
+  case tok_integer:
+    return ParseIntegerExpr();
   case tok_if:
     return ParseIfExpr();
-  case '(':
+  case tok_for:
+    return ParseForExpr();
+  case tok_leftParen:
     return ParseParenExpr();
   }
 }
@@ -117,6 +210,7 @@ std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int ExprPrec,
 
     // Okay, we know this is a binop.
     int BinOp = Lex.CurTok;
+    SourceLocation BinLoc = Lex.getTokLoc();
     Lex.lex(); // eat binop
 
     // Parse the primary expression after the binary operator.
@@ -134,8 +228,12 @@ std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int ExprPrec,
     }
 
     // Merge LHS/RHS.
-    LHS =
-        std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
+    std::string Key = std::string("b") + char(BinOp);
+    bool Pure = appendSharedID(Key, *LHS) && appendSharedID(Key, *RHS);
+    LHS = std::make_unique<BinaryExprAST>(BinLoc, BinOp, std::move(LHS),
+                                          std::move(RHS));
+    if (Pure)
+      LHS = share(Key, std::move(LHS));
   }
 }
 
@@ -150,27 +248,96 @@ std::unique_ptr<ExprAST> Parser::ParseExpression() {
   return ParseBinOpRHS(0, std::move(LHS));
 }
 
+/// typeannotation
+///   ::= ':' ('double' | 'float32' | 'int64' | 'bool')
+///   ::= ':' ('double' | 'float32' | 'int64') '[' ']'
+bool Parser::ParseTypeAnnotation(TypeKind &Ty) {
+  Lex.lex(); // eat ':'.
+  if (Lex.CurTok != tok_identifier) {
+    LogError("Expected type name after ':'");
+    return false;
+  }
+
+  if (Lex.IdentifierStr == "double")
+    Ty = ty_double;
+  else if (Lex.IdentifierStr == "float32")
+    Ty = ty_float32;
+  else if (Lex.IdentifierStr == "int64")
+    Ty = ty_int64;
+  else if (Lex.IdentifierStr == "bool")
+    Ty = ty_bool;
+  else {
+    LogError("Unknown type name");
+    return false;
+  }
+  Lex.lex(); // eat type name.
+
+  if (Lex.CurTok == '[') {
+    if (Lex.lex() != ']') {
+      LogError("Expected ']' in array type");
+      return false;
+    }
+    Lex.lex(); // eat ].
+    if (Ty == ty_bool) {
+      LogError("bool arrays are not supported");
+      return false;
+    }
+    Ty = getArrayType(Ty);
+  }
+  return true;
+}
+
 /// prototype
-///   ::= id '(' id* ')'
+///   ::= 'fastmath'? id '(' (id typeannotation?)* ')' typeannotation?
+/// The return type must be a scalar.
 std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
   if (Lex.CurTok != tok_identifier)
     return LogErrorP("Expected function name in prototype");
 
   std::string FnName = Lex.IdentifierStr;
+  SourceLocation FnLoc = Lex.getTokLoc();
   Lex.lex();
 
+  // 'fastmath' is only a modifier when another name follows it, so a
+  // function can still be called fastmath.
+  bool FastMath = false;
+  if (FnName == "fastmath" && Lex.CurTok == tok_identifier) {
+    FastMath = true;
+    FnName = Lex.IdentifierStr;
+    FnLoc = Lex.getTokLoc();
+    Lex.lex();
+  }
+  DeclaredNames.insert(FnName);
+
   if (Lex.CurTok != tok_leftParen)
     return LogErrorP("Expected '(' in prototype");
   std::vector<std::string> ArgNames;
-  while (Lex.lex() == tok_identifier) {
+  std::vector<TypeKind> ArgTypes;
+  Lex.lex(); // eat '('.
+  while (Lex.CurTok == tok_identifier) {
     ArgNames.push_back(Lex.IdentifierStr);
+    Lex.lex(); // eat argument name.
+
+    TypeKind Ty = ty_double;
+    if (Lex.CurTok == ':' && !ParseTypeAnnotation(Ty))
+      return nullptr;
+    ArgTypes.push_back(Ty);
   }
 
   if (Lex.CurTok != tok_rightParen)
     return LogErrorP("Expected ')' in prototype");
 
   Lex.lex();
-  return std::make_unique<PrototypeAST>(FnName, std::move(ArgNames));
+
+  TypeKind RetType = ty_double;
+  if (Lex.CurTok == ':' && !ParseTypeAnnotation(RetType))
+    return nullptr;
+  if (isArrayType(RetType))
+    return LogErrorP("functions cannot return arrays");
+
+  return std::make_unique<PrototypeAST>(FnLoc, FnName, std::move(ArgNames),
+                                        std::move(ArgTypes), RetType,
+                                        FastMath);
 }
 
 /// definition ::= 'def' prototype expression
@@ -187,10 +354,11 @@ std::unique_ptr<FunctionAST> Parser::ParseDefinition() {
 
 /// toplevelexpr ::= expression
 std::unique_ptr<FunctionAST> Parser::ParseTopLevelExpr() {
+  SourceLocation FnLoc = Lex.getTokLoc();
   if (auto E = ParseExpression()) {
     // Make an anonymous proto
     // Make_unique构建函数
-    auto Proto = std::make_unique<PrototypeAST>("__anon_expr",
+    auto Proto = std::make_unique<PrototypeAST>(FnLoc, "__anon_expr",
                                                 std::vector<std::string>());
     return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
   }
@@ -206,6 +374,7 @@ std::unique_ptr<PrototypeAST> Parser::ParseExtern() {
 /// ifexpr ::= 'if' expression 'then' expression 'else' expression
 /// Entry point for parsing conditiaonal statement
 std::unique_ptr<IfExprAST> Parser::ParseIfExpr() {
+  SourceLocation IfLoc = Lex.getTokLoc();
   // condition.
   Lex.lex();
   auto Cond = ParseExpression();
@@ -213,7 +382,7 @@ std::unique_ptr<IfExprAST> Parser::ParseIfExpr() {
     return nullptr;
 
   if (Lex.CurTok != tok_then) {
-    std::cout << "expected then" << std::endl;
+    LogError("expected then");
     return nullptr;
   }
 
@@ -224,7 +393,7 @@ std::unique_ptr<IfExprAST> Parser::ParseIfExpr() {
     return nullptr;
 
   if (Lex.CurTok != tok_else) {
-    std::cout << "expected else" << std::endl;
+    LogError("expected else");
     return nullptr;
   }
 
@@ -234,10 +403,70 @@ std::unique_ptr<IfExprAST> Parser::ParseIfExpr() {
   if (!Else)
     return nullptr;
 
-  return std::make_unique<IfExprAST>(std::move(Cond), std::move(Then),
-                                      std::move(Else));
+  return std::make_unique<IfExprAST>(IfLoc, std::move(Cond), std::move(Then),
+                                     std::move(Else));
 }
 
+/// forexpr ::= 'for' identifier '=' expression ',' expression
+///             (',' expression)? 'in' expression
+/// The step defaults to 1. With a positive step the loop runs while the
+/// variable is below the end, with a negative one while it is above it; a
+/// constant step of 0 is an error and a step that is 0 at run time makes no
+/// iterations. The loop also stops if the next value would overflow.
+std::unique_ptr<ForExprAST> Parser::ParseForExpr() {
+  SourceLocation ForLoc = Lex.getTokLoc();
+  Lex.lex(); // eat the for.
+
+  if (Lex.CurTok != tok_identifier) {
+    LogError("expected identifier after for");
+    return nullptr;
+  }
+
+  std::string IdName = Lex.IdentifierStr;
+  Lex.lex(); // eat identifier.
+
+  if (Lex.CurTok != '=') {
+    LogError("expected '=' after for");
+    return nullptr;
+  }
+  Lex.lex(); // eat '='.
+
+  auto Start = ParseExpression();
+  if (!Start)
+    return nullptr;
+  if (Lex.CurTok != ',') {
+    LogError("expected ',' after for start value");
+    return nullptr;
+  }
+  Lex.lex();
+
+  auto End = ParseExpression();
+  if (!End)
+    return nullptr;
+
+  // The step value is optional.
+  std::unique_ptr<ExprAST> Step;
+  if (Lex.CurTok == ',') {
+    Lex.lex();
+    Step = ParseExpression();
+    if (!Step)
+      return nullptr;
+  }
+
+  if (Lex.CurTok != tok_in) {
+    LogError("expected 'in' after for");
+    return nullptr;
+  }
+  Lex.lex(); // eat 'in'.
+
+  auto Body = ParseExpression();
+  if (!Body)
+    return nullptr;
+
+  return std::make_unique<ForExprAST>(ForLoc, IdName, std::move(Start),
+                                      std::move(End), std::move(Step),
+                                      std::move(Body));
+}
 
 // Driver to dive the parser goes on
 //===----------------------------------------------------------------------===//
@@ -247,9 +476,7 @@ std::unique_ptr<IfExprAST> Parser::ParseIfExpr() {
 void Parser::HandleDefinition() {
   if (auto FnAST = ParseDefinition()) {
     fprintf(stderr, "Parsed a function definition.\n");
-    if (auto *FnIR = FnAST->codegen()) {
-      FnIR->print(errs());
-    }
+    emitItem({TopLevelItem::Definition, std::move(FnAST), nullptr});
   } else {
     // Skip token for error recovery.
     Lex.lex();
@@ -259,9 +486,7 @@ void Parser::HandleDefinition() {
 void Parser::HandleExtern() {
   if (auto ProtoAST = ParseExtern()) {
     fprintf(stderr, "Parsed an extern\n");
-    if (auto *FnIR = ProtoAST->codegen()) {
-      FnIR->print(errs());
-    }
+    emitItem({TopLevelItem::Extern, nullptr, std::move(ProtoAST)});
   } else {
     // Skip token for error recovery.
     Lex.lex();
@@ -272,18 +497,105 @@ void Parser::HandleTopLevelExpression() {
   // Evaluate a top-level expression into an anonymous function.
   if (auto FnASt = ParseTopLevelExpr()) {
     fprintf(stderr, "Parsed a top-level expr\n");
-    if (auto FnIR = FnASt->codegen()) {
-      FnIR->print(errs());
-    }
+    emitItem({TopLevelItem::Expression, std::move(FnASt), nullptr});
   } else {
     // Skip token for error recovery.
     Lex.lex();
   }
 }
 
+void Parser::emitItem(TopLevelItem Item) {
+  if (Program)
+    Program->push_back(std::move(Item));
+  else
+    handleItemError(runItem(std::move(Item)));
+}
+
+//===----------------------------------------------------------------------===//
+// Running parsed items
+//===----------------------------------------------------------------------===//
+
+Error Parser::runItem(TopLevelItem Item) {
+  switch (Item.Kind) {
+  case TopLevelItem::Definition:
+    if (auto *FnIR = Item.Fn->codegen()) {
+      FnIR->print(errs());
+      if (JIT) {
+        Error Err = JIT->addModule(TakeModule());
+        InitializeModule(SourceName);
+        return Err;
+      }
+    } else if (JIT) {
+      // Drop whatever the failed item left in the module.
+      InitializeModule(SourceName);
+    }
+    break;
+  case TopLevelItem::Extern:
+    if (auto *FnIR = Item.Proto->codegen()) {
+      FnIR->print(errs());
+      FunctionProtos[Item.Proto->getName()] = std::move(Item.Proto);
+    }
+    break;
+  case TopLevelItem::Expression:
+    if (auto FnIR = Item.Fn->codegen()) {
+      FnIR->print(errs());
+      if (JIT) {
+        // Give the anonymous expression its own tracker so its code can be
+        // freed once it has run.
+        auto RT = JIT->getDylib().createResourceTracker();
+        Error Err = JIT->addModule(TakeModule(), RT);
+        InitializeModule(SourceName);
+        if (Err)
+          return joinErrors(std::move(Err), RT->remove());
+
+        auto ExprSymbol = JIT->lookup("__anon_expr");
+        if (!ExprSymbol)
+          return joinErrors(ExprSymbol.takeError(), RT->remove());
+        double (*FP)() = (double (*)())(intptr_t)ExprSymbol->getAddress();
+        fprintf(stderr, "Evaluated to %f\n", FP());
+
+        return RT->remove();
+      }
+    } else if (JIT) {
+      InitializeModule(SourceName);
+    }
+    break;
+  }
+  return Error::success();
+}
+
+/// handleItemError - Exit on a JIT error, or report it and go on with the
+/// next item when ContinueOnJITError is set.
+void Parser::handleItemError(Error Err) {
+  if (!Err)
+    return;
+  if (ContinueOnJITError)
+    LogError(toString(std::move(Err)).c_str());
+  else
+    ExitOnErr(std::move(Err));
+}
+
+void Parser::run(std::vector<TopLevelItem> Items) {
+  InitializeModule(SourceName);
+  for (auto &Item : Items)
+    handleItemError(runItem(std::move(Item)));
+}
+
+bool Parser::parseProgram(std::string Content,
+                          std::vector<TopLevelItem> &Items) {
+  unsigned ErrorsBefore = NumErrors;
+  Program = &Items;
+  parse(Content);
+  Program = nullptr;
+  return NumErrors == ErrorsBefore;
+}
+
 /// top ::= definition | external | expression | ';'
 void Parser::parse(std::string Content) {
   Lex.init(Content);
+  SharedNodes.clear();
+  InitializeModule(SourceName);
+  Lex.lex();
   while (true) {
     switch (Lex.CurTok) {
     case tok_eof:
@@ -2,30 +2,60 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "JIT.h"
 #include "Lexer.h"
 #include <map>
 #include <memory>
+#include <set>
 #include <utility>
+
+/// NumErrors - How many errors have been reported through LogError.
+extern unsigned NumErrors;
+
 class Parser {
 public:
   Lexer Lex;
+  /// JIT - When set, definitions are compiled into it and top-level
+  /// expressions are evaluated; otherwise only the IR is printed.
+  ToyJIT *JIT = nullptr;
+  /// SourceName - File name recorded in the emitted debug info.
+  std::string SourceName = "<stdin>";
+  /// Program - While set, parsed items are collected here instead of run.
+  std::vector<TopLevelItem> *Program = nullptr;
+  /// HashCons - Share structurally identical pure subexpressions between
+  /// all their occurrences (see SharedExprAST).
+  bool HashCons = false;
+  /// SharedNodes - Canonical node and ID for each hash-cons key.
+  std::map<std::string, std::pair<std::shared_ptr<ExprAST>, unsigned>>
+      SharedNodes;
+  /// DeclaredNames - Functions the program declares; calls to them are not
+  /// known to be pure even if they share a math builtin's name.
+  std::set<std::string> DeclaredNames;
+  /// ContinueOnJITError - Report JIT errors, such as unresolved or duplicate
+  /// symbols, and go on with the next item instead of exiting.
+  bool ContinueOnJITError = false;
 public:
   Parser(/* args */){};
   ~Parser(){};
 
   int lexPrecedence();
+  std::unique_ptr<ExprAST> share(const std::string &Key,
+                                 std::unique_ptr<ExprAST> E);
   std::unique_ptr<ExprAST> ParseNumberExpr();
+  std::unique_ptr<ExprAST> ParseIntegerExpr();
   std::unique_ptr<ExprAST> ParseParenExpr();
   std::unique_ptr<ExprAST> ParseIdentifierExpr();
   std::unique_ptr<ExprAST> ParsePrimary();
   std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
                                               std::unique_ptr<ExprAST> LHS);
   std::unique_ptr<ExprAST> ParseExpression();
+  bool ParseTypeAnnotation(TypeKind &Ty);
   std::unique_ptr<PrototypeAST> ParsePrototype();
   std::unique_ptr<FunctionAST> ParseDefinition();
   std::unique_ptr<FunctionAST> ParseTopLevelExpr();
   std::unique_ptr<PrototypeAST> ParseExtern();
   std::unique_ptr<IfExprAST> ParseIfExpr();
+  std::unique_ptr<ForExprAST> ParseForExpr();
 
   // Init the parser
 
@@ -33,7 +63,18 @@ public:
   void HandleDefinition();
   void HandleExtern();
   void HandleTopLevelExpression();
+  void emitItem(TopLevelItem Item);
   void parse(std::string Content);
+
+  /// parseProgram - Parse \p Content into \p Items without generating code.
+  /// Returns false if any error was reported, since the items that failed to
+  /// parse are missing.
+  bool parseProgram(std::string Content, std::vector<TopLevelItem> &Items);
+  /// runItem, run - Generate code for, and with a JIT evaluate, already
+  /// parsed items. runItem returns JIT errors; run handles them like parse.
+  Error runItem(TopLevelItem Item);
+  void handleItemError(Error Err);
+  void run(std::vector<TopLevelItem> Items);
 };
 
 #endif
\ No newline at end of file
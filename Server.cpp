@@ -0,0 +1,223 @@
+#include "Server.h"
+#include "ASTSerializer.h"
+#include "Codegen.h"
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <sys/un.h>
+#include <sys/wait.h>
+
+using namespace toyserver;
+
+extern std::unique_ptr<ExprAST> LogError(const char *Str);
+
+static void flushOutput() {
+  fflush(stdout);
+  fflush(stderr);
+  outs().flush();
+  errs().flush();
+}
+
+/// WarmState - What a request can change outside the JIT, as it was before
+/// the worker's first request.
+struct WarmState {
+  std::map<std::string, PrototypeAST> Protos;
+  std::set<std::string> DeclaredNames;
+  bool FastMath;
+
+  explicit WarmState(const Parser &P)
+      : DeclaredNames(P.DeclaredNames), FastMath(EnableFastMath) {
+    for (auto &Entry : FunctionProtos)
+      Protos.emplace(Entry.first, *Entry.second);
+  }
+
+  void restore(Parser &P) const {
+    FunctionProtos.clear();
+    for (auto &Entry : Protos)
+      FunctionProtos[Entry.first] =
+          std::make_unique<PrototypeAST>(Entry.second);
+    P.DeclaredNames = DeclaredNames;
+    EnableFastMath = FastMath;
+  }
+};
+
+/// runRequest - Compile and run one request with \p P. Its code goes to a
+/// scratch JITDylib, so it cannot clash with other requests.
+static void runRequest(Parser &P, uint32_t Flags, std::string Name,
+                       std::string Data) {
+  P.SourceName = Name.empty() ? "<stdin>" : Name;
+  P.HashCons = Flags & RF_HashCons;
+  if (Flags & RF_FastMath)
+    EnableFastMath = true;
+  if (auto Err = P.JIT->beginScratch()) {
+    LogError(toString(std::move(Err)).c_str());
+    return;
+  }
+
+  if (isSerializedAST(Data)) {
+    std::vector<TopLevelItem> Items;
+    if (readProgram(Data, Items, P.SourceName))
+      P.run(std::move(Items));
+  } else {
+    P.parse(std::move(Data));
+  }
+
+  if (auto Err = P.JIT->endScratch())
+    LogError(toString(std::move(Err)).c_str());
+}
+
+/// serveSession - Answer the requests on \p Conn until the client is done.
+/// What a request prints, including the output of the code it runs, is
+/// captured in a scratch file and sent back as its reply.
+static void serveSession(int Conn, Parser &P, const WarmState &Warm) {
+  FILE *Capture = tmpfile();
+  if (!Capture) {
+    LogError("cannot create the output capture file");
+    return;
+  }
+  int CaptureFD = fileno(Capture);
+  int SavedOut = dup(STDOUT_FILENO), SavedErr = dup(STDERR_FILENO);
+
+  RequestHeader Req;
+  while (readAll(Conn, &Req, sizeof(Req))) {
+    if (memcmp(Req.Magic, Magic, sizeof(Magic)) != 0) {
+      LogError("malformed compile-server request");
+      break;
+    }
+    std::string Name(Req.NameSize, '\0'), Data(Req.DataSize, '\0');
+    if (!readAll(Conn, &Name[0], Name.size()) ||
+        !readAll(Conn, &Data[0], Data.size()))
+      break;
+
+    flushOutput();
+    if (ftruncate(CaptureFD, 0) != 0 || lseek(CaptureFD, 0, SEEK_SET) != 0)
+      break;
+    dup2(CaptureFD, STDOUT_FILENO);
+    dup2(CaptureFD, STDERR_FILENO);
+
+    Warm.restore(P);
+    NumErrors = 0;
+    runRequest(P, Req.Flags, std::move(Name), std::move(Data));
+
+    flushOutput();
+    dup2(SavedOut, STDOUT_FILENO);
+    dup2(SavedErr, STDERR_FILENO);
+
+    off_t Size = lseek(CaptureFD, 0, SEEK_CUR);
+    std::string Output(Size > 0 ? Size : 0, '\0');
+    if (pread(CaptureFD, &Output[0], Output.size(), 0) !=
+        (ssize_t)Output.size())
+      break;
+
+    ReplyHeader Reply;
+    Reply.Status = NumErrors != 0;
+    Reply.OutputSize = Output.size();
+    if (!writeAll(Conn, &Reply, sizeof(Reply)) ||
+        !writeAll(Conn, Output.data(), Output.size()))
+      break;
+  }
+  close(SavedOut);
+  close(SavedErr);
+  fclose(Capture);
+}
+
+/// warmUp - Compile and run a little code, so that the one-time work of
+/// the optimizer and code generator is not left to the first request.
+static void warmUp(Parser &P) {
+  P.parse("for i = 0, 4 in sqrt(2.0 * i)");
+}
+
+/// startWorker - Fork a worker that serves one session after another from
+/// \p Listener. Its own warm-up touches the memory it shares with the server
+/// before any client waits for it.
+static void startWorker(int Listener, Parser &P) {
+  flushOutput();
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    LogError(("fork failed: " + Twine(strerror(errno))).str().c_str());
+    return;
+  }
+  if (Pid != 0)
+    return;
+
+#ifdef __linux__
+  // Go down with the server.
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+  P.JIT->reopenProfilingAfterFork();
+  warmUp(P);
+  WarmState Warm(P);
+  while (true) {
+    int Conn = accept(Listener, nullptr, nullptr);
+    if (Conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      LogError(("accept failed: " + Twine(strerror(errno))).str().c_str());
+      flushOutput();
+      _exit(1);
+    }
+    serveSession(Conn, P, Warm);
+    close(Conn);
+  }
+}
+
+int runServer(StringRef SocketPath, unsigned NumWorkers, Parser &P) {
+  sockaddr_un Addr;
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (SocketPath.empty() || SocketPath.size() >= sizeof(Addr.sun_path)) {
+    LogError(("invalid socket path: " + SocketPath).str().c_str());
+    return 1;
+  }
+  memcpy(Addr.sun_path, SocketPath.data(), SocketPath.size());
+
+  int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Listener < 0) {
+    LogError(("cannot create socket: " + Twine(strerror(errno))).str().c_str());
+    return 1;
+  }
+  // Replace the socket a previous server left behind.
+  unlink(Addr.sun_path);
+  if (bind(Listener, (sockaddr *)&Addr, sizeof(Addr)) != 0 ||
+      listen(Listener, SOMAXCONN) != 0) {
+    LogError(("cannot listen on " + SocketPath + ": " + strerror(errno))
+                 .str()
+                 .c_str());
+    close(Listener);
+    return 1;
+  }
+
+  // A failing item fails its request, not the worker.
+  P.ContinueOnJITError = true;
+
+  // The JIT compiles lazily, so nothing has been through the optimizer and
+  // code generator yet. Do that once here rather than in every worker.
+  warmUp(P);
+  fprintf(stderr, "Listening on %s with %u workers\n", Addr.sun_path,
+          NumWorkers);
+
+  // A client that goes away only ends its own session.
+  signal(SIGPIPE, SIG_IGN);
+
+  // Keep NumWorkers workers running, replacing any that die.
+  for (unsigned i = 0; i != NumWorkers; ++i)
+    startWorker(Listener, P);
+  while (true) {
+    int Status;
+    pid_t Pid = wait(&Status);
+    if (Pid < 0) {
+      if (errno == EINTR)
+        continue;
+      LogError(("wait failed: " + Twine(strerror(errno))).str().c_str());
+      close(Listener);
+      return 1;
+    }
+    if (WIFSIGNALED(Status))
+      fprintf(stderr, "Warning: worker %d terminated by %s\n", (int)Pid,
+              strsignal(WTERMSIG(Status)));
+    startWorker(Listener, P);
+  }
+}
@@ -0,0 +1,15 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "Parser.h"
+#include "ServerProtocol.h"
+
+/// runServer - Listen on the Unix socket \p SocketPath and serve requests
+/// with \p P, whose JIT already holds the definitions shared by all requests.
+/// \p NumWorkers forked copies of the warm server accept connections, so as
+/// many sessions run concurrently, and a crash only ends its own session.
+/// Each request runs as if it were a separate `toy` invocation: what it
+/// defines is discarded when it finishes. Only returns on error.
+int runServer(StringRef SocketPath, unsigned NumWorkers, Parser &P);
+
+#endif
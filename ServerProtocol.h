@@ -0,0 +1,70 @@
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+#include "llvm/Support/Endian.h"
+#include <cerrno>
+#include <unistd.h>
+
+// Compile-server protocol, shared by `toy -server` and the `toyc` client.
+// A client connects to the server's Unix socket and sends any number of
+// requests; each is answered by one reply, in order, so a whole batch can be
+// written before the first reply is read. Every field is a little-endian
+// integer with alignment 1:
+//
+//   RequestHeader, char [NameSize] source name, char [DataSize] source text
+//                  or KAST image
+//   ReplyHeader,   char [OutputSize] what the request printed
+namespace toyserver {
+using llvm::support::ulittle32_t;
+
+const char Magic[4] = {'T', 'O', 'Y', 'R'};
+
+enum RequestFlags : uint32_t {
+  RF_HashCons = 1 << 0, // as -hash-cons
+  RF_FastMath = 1 << 1, // as -ffast-math
+};
+
+struct RequestHeader {
+  char Magic[4];
+  ulittle32_t Flags;
+  ulittle32_t NameSize;
+  ulittle32_t DataSize;
+};
+
+struct ReplyHeader {
+  ulittle32_t Status; // 0 if the request ran without errors
+  ulittle32_t OutputSize;
+};
+
+/// readAll, writeAll - Transfer exactly \p Size bytes, retrying short and
+/// interrupted transfers. readAll fails at end of file.
+inline bool readAll(int FD, void *Buf, size_t Size) {
+  char *P = static_cast<char *>(Buf);
+  while (Size) {
+    ssize_t N = read(FD, P, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Size -= N;
+  }
+  return true;
+}
+
+inline bool writeAll(int FD, const void *Buf, size_t Size) {
+  const char *P = static_cast<const char *>(Buf);
+  while (Size) {
+    ssize_t N = write(FD, P, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Size -= N;
+  }
+  return true;
+}
+} // namespace toyserver
+
+#endif
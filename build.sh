@@ -4,4 +4,7 @@ clang++ -g -O3  \
       Parser.cpp \
       toy.cpp \
       Codegen.cpp \
-      `llvm-config --cxxflags --ldflags --system-libs --libs core` -o toy
\ No newline at end of file
+      ASTSerializer.cpp \
+      Server.cpp \
+      `llvm-config --cxxflags --ldflags --system-libs --libs core orcjit native passes perfjitevents` -o toy
+clang++ -O3 toyc.cpp `llvm-config --cxxflags` -pthread -o toyc
@@ -1,6 +1,33 @@
+#include "ASTSerializer.h"
+#include "Codegen.h"
 #include "Parser.h"
+#include "Server.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include <cstring>
+#include <thread>
 extern std::map<char, int> BinopPrecedence;
-int main() {
+
+/// toy [-perf] [-ffast-math] [-hash-cons] [-emit-ast out] [file]
+/// toy -server socket [-j workers] [-perf] [-ffast-math] [file]
+///   -perf         Report JIT'd functions to perf (perf map file and jitdump).
+///   -ffast-math   Compile every function as if it were declared `fastmath`.
+///   -hash-cons    Parse repeated pure subexpressions into one shared node.
+///   -emit-ast out Parse the source and save its AST to `out` instead of
+///                 running it.
+///   -server socket
+///                 Stay resident and serve compile requests from `toyc` on the
+///                 Unix socket `socket`. `file`, if given, is compiled first
+///                 and its definitions are available to every request.
+///   -j workers    Number of requests the server handles concurrently; the
+///                 default is the number of hardware threads.
+///   file          Source to run, or an AST saved by -emit-ast; without it a
+///                 small built-in test is used.
+int main(int argc, char **argv) {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+
   // Install standard binary operators.
   // 1 is lowest precedence.
   BinopPrecedence['<'] = 10;
@@ -8,10 +35,80 @@ int main() {
   BinopPrecedence['-'] = 20;
   BinopPrecedence['*'] = 40; // highest.
 
-  Parser parser;
-  // Run the main "interpreter loop" now.
+  bool EnableProfiling = false;
+  bool HashCons = false;
+  const char *FileName = nullptr;
+  const char *EmitASTFile = nullptr;
+  const char *ServerSocket = nullptr;
+  unsigned NumWorkers = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-perf"))
+      EnableProfiling = true;
+    else if (!strcmp(argv[i], "-ffast-math"))
+      EnableFastMath = true;
+    else if (!strcmp(argv[i], "-hash-cons"))
+      HashCons = true;
+    else if (!strcmp(argv[i], "-emit-ast") && i + 1 < argc)
+      EmitASTFile = argv[++i];
+    else if (!strcmp(argv[i], "-server") && i + 1 < argc)
+      ServerSocket = argv[++i];
+    else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+      NumWorkers = std::max(1, atoi(argv[++i]));
+    else
+      FileName = argv[i];
+  }
+
   std::string test = "extern foo();extern bar();def baz(x) if x then foo() else bar()";
-  parser.parse(test);
+  std::unique_ptr<MemoryBuffer> Buf;
+  if (FileName) {
+    // Large files are mapped rather than read, which lets a serialized AST
+    // be decoded in place.
+    auto BufOrErr = MemoryBuffer::getFile(FileName, /*IsText=*/false,
+                                          /*RequiresNullTerminator=*/false);
+    if (!BufOrErr) {
+      fprintf(stderr, "Error: cannot read %s\n", FileName);
+      return 1;
+    }
+    Buf = std::move(*BufOrErr);
+  }
+
+  Parser parser;
+  parser.HashCons = HashCons;
+  if (Buf)
+    parser.SourceName = FileName;
+
+  if (EmitASTFile) {
+    if (Buf && isSerializedAST(Buf->getBuffer())) {
+      fprintf(stderr, "Error: %s is already a serialized AST\n", FileName);
+      return 1;
+    }
+    // A program with parse errors would be saved without the items that
+    // failed, so nothing is written.
+    std::vector<TopLevelItem> Items;
+    if (!parser.parseProgram(Buf ? Buf->getBuffer().str() : test, Items)) {
+      fprintf(stderr, "Error: %s not written\n", EmitASTFile);
+      return 1;
+    }
+    return writeProgram(Items, EmitASTFile, parser.SourceName) ? 0 : 1;
+  }
+
+  ExitOnError ExitOnErr("toy: ");
+  auto JIT = ExitOnErr(ToyJIT::Create(EnableProfiling,
+                                      /*WillFork=*/ServerSocket != nullptr));
+  parser.JIT = JIT.get();
+
+  // A serialized AST goes straight to codegen without lexing or parsing.
+  if (Buf && isSerializedAST(Buf->getBuffer())) {
+    std::vector<TopLevelItem> Items;
+    if (!readProgram(Buf->getBuffer(), Items, parser.SourceName))
+      return 1;
+    parser.run(std::move(Items));
+  } else if (Buf || !ServerSocket) {
+    // Run the main "interpreter loop" now.
+    parser.parse(Buf ? Buf->getBuffer().str() : test);
+  }
 
+  if (ServerSocket)
+    return runServer(ServerSocket, NumWorkers, parser);
   return 0;
-}
\ No newline at end of file
+}
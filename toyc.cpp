@@ -0,0 +1,134 @@
+#include "ServerProtocol.h"
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace toyserver;
+
+/// readFile - Read all of \p FD into \p Data.
+static bool readFile(int FD, std::string &Data) {
+  char Buf[65536];
+  while (true) {
+    ssize_t N = read(FD, Buf, sizeof(Buf));
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N < 0)
+      return false;
+    if (N == 0)
+      return true;
+    Data.append(Buf, N);
+  }
+}
+
+/// toyc [-ffast-math] [-hash-cons] socket [file...]
+///   Thin client for `toy -server socket`: sends the files (or standard
+///   input) to the server as one batch and prints what each of them printed,
+///   in order. Links no LLVM, so it starts as fast as the server answers.
+///   -ffast-math   As `toy -ffast-math`.
+///   -hash-cons    As `toy -hash-cons`.
+///   Exits with 1 if any file failed to compile or run.
+int main(int argc, char **argv) {
+  uint32_t Flags = 0;
+  const char *SocketPath = nullptr;
+  std::vector<const char *> Files;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-ffast-math"))
+      Flags |= RF_FastMath;
+    else if (!strcmp(argv[i], "-hash-cons"))
+      Flags |= RF_HashCons;
+    else if (!SocketPath)
+      SocketPath = argv[i];
+    else
+      Files.push_back(argv[i]);
+  }
+  if (!SocketPath) {
+    fprintf(stderr, "usage: toyc [-ffast-math] [-hash-cons] socket [file...]\n");
+    return 1;
+  }
+
+  // Load the whole batch first so a missing file sends nothing.
+  std::vector<std::pair<std::string, std::string>> Batch;
+  if (Files.empty()) {
+    Batch.emplace_back("", "");
+    if (!readFile(STDIN_FILENO, Batch.back().second)) {
+      fprintf(stderr, "Error: cannot read standard input\n");
+      return 1;
+    }
+  }
+  for (const char *FileName : Files) {
+    Batch.emplace_back(FileName, "");
+    int FD = open(FileName, O_RDONLY);
+    bool Read = FD >= 0 && readFile(FD, Batch.back().second);
+    if (FD >= 0)
+      close(FD);
+    if (!Read) {
+      fprintf(stderr, "Error: cannot read %s\n", FileName);
+      return 1;
+    }
+  }
+
+  sockaddr_un Addr;
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (strlen(SocketPath) >= sizeof(Addr.sun_path)) {
+    fprintf(stderr, "Error: invalid socket path: %s\n", SocketPath);
+    return 1;
+  }
+  strcpy(Addr.sun_path, SocketPath);
+  int Conn = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Conn < 0 || connect(Conn, (sockaddr *)&Addr, sizeof(Addr)) != 0) {
+    fprintf(stderr, "Error: cannot connect to %s: %s\n", SocketPath,
+            strerror(errno));
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  // Requests are written while the replies are read, so neither side can
+  // block on a full socket buffer.
+  std::thread Writer([&]() {
+    for (auto &Entry : Batch) {
+      RequestHeader Req;
+      memcpy(Req.Magic, Magic, sizeof(Magic));
+      Req.Flags = Flags;
+      Req.NameSize = Entry.first.size();
+      Req.DataSize = Entry.second.size();
+      if (!writeAll(Conn, &Req, sizeof(Req)) ||
+          !writeAll(Conn, Entry.first.data(), Entry.first.size()) ||
+          !writeAll(Conn, Entry.second.data(), Entry.second.size()))
+        break;
+    }
+    shutdown(Conn, SHUT_WR);
+  });
+
+  int Status = 0;
+  for (size_t i = 0, e = Batch.size(); i != e; ++i) {
+    ReplyHeader Reply;
+    std::string Output;
+    if (readAll(Conn, &Reply, sizeof(Reply))) {
+      Output.resize(Reply.OutputSize);
+      if (readAll(Conn, &Output[0], Output.size())) {
+        fwrite(Output.data(), 1, Output.size(), stderr);
+        if (Reply.Status)
+          Status = 1;
+        continue;
+      }
+    }
+    fprintf(stderr, "Error: the server closed the session before answering "
+                    "all requests\n");
+    Status = 1;
+    break;
+  }
+
+  // Unblock the writer if the session ended early.
+  shutdown(Conn, SHUT_RDWR);
+  Writer.join();
+  close(Conn);
+  return Status;
+}